@@ -0,0 +1,363 @@
+/*
+ *  c-gomoku-cli, a command line interface for Gomocup engines. Copyright 2021 Chao Ma.
+ *  c-gomoku-cli is derived from c-chess-cli, originally authored by lucasart 2020.
+ *
+ *  c-gomoku-cli is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ *  c-gomoku-cli is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this
+ * program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmark suite of Position. Random legal games are replayed for each board size
+// and rule, timing the functions a game spends its time in. The full board five scan is
+// also timed with each scan kernel supported by the CPU. Results are written to stdout as
+// JSON, one record per (function, size, rule), so that runs of different commits can be
+// compared.
+//
+// The fast paths are also checked against their reference on every position of the
+// games: the exit status is non zero on any mismatch, which release builds (NDEBUG) would
+// not catch with their asserts.
+
+#include "position.h"
+#include "util.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+static const int GamesPerCase = 40;
+static const int Repeats      = 10;
+static const int OpeningPlies = 8;
+
+static const struct
+{
+    GameRule    rule;
+    const char *name;
+} Rules[] = {
+    {GOMOKU_FIVE_OR_MORE, "freestyle"},
+    {GOMOKU_EXACT_FIVE, "standard"},
+    {RENJU, "renju"},
+};
+
+enum BenchFunction {
+    BENCH_MOVE,
+    BENCH_MOVE_WITH_COPY,
+    BENCH_FIVE_LASTMOVE,
+    BENCH_FORBIDDEN,
+    BENCH_FORBIDDEN_REF,
+    BENCH_TRANSFORM,
+    BENCH_OPENING,
+    BENCH_FIVE_WALK,
+    BENCH_FIVE_SCAN,  // one per scan kernel
+    NB_BENCH_FUNCTION = BENCH_FIVE_SCAN + NB_SCAN_KERNEL
+};
+
+static const char *BenchFunctionName[BENCH_FIVE_SCAN] = {"move",
+                                                         "move_with_copy",
+                                                         "check_five_in_line_lastmove",
+                                                         "check_forbidden_move",
+                                                         "check_forbidden_move_ref",
+                                                         "transform",
+                                                         "apply_opening",
+                                                         "check_five_in_line_side_ref"};
+
+// Fast path checks against their reference
+enum BenchCheck {
+    CHECK_FIVE_SCAN,      // each scan kernel against the full board walk
+    CHECK_FIVE_LASTMOVE,  // last move five against the full board scan
+    CHECK_FORBIDDEN,      // renju forbidden points against the reference finder
+    CHECK_LINE_PATTERNS,  // line pattern table against the reference walks
+    NB_BENCH_CHECK
+};
+
+static const char *BenchCheckName[NB_BENCH_CHECK] = {"five_scan",
+                                                     "five_lastmove",
+                                                     "forbidden",
+                                                     "line_patterns"};
+
+struct BenchResult
+{
+    double ns  = 0;
+    long   ops = 0;
+};
+
+static volatile int sink;  // keeps the results of the timed calls alive
+
+// Same as Game::game_apply_rules()
+static bool allow_long_connection(GameRule rule, Color lastColor)
+{
+    return rule == GOMOKU_FIVE_OR_MORE || (rule == RENJU && lastColor == WHITE);
+}
+
+// A random legal game, stopping at the first five. Black never plays a forbidden point
+// under renju rule.
+static std::vector<move_t> random_game(int size, GameRule rule, uint64_t &seed)
+{
+    std::vector<move_t> game;
+    Position            pos(size);
+
+    while (pos.get_moves_left() > 0) {
+        move_t move  = NONE_MOVE;
+        int    tries = 0;
+        do {
+            if (++tries > 4 * size * size)
+                return game;  // only forbidden points are left
+
+            const int x = prng(seed) % size, y = prng(seed) % size;
+            move        = (pos.get_turn() << 10) | POS(x, y);
+        } while (!pos.is_legal_move(move)
+                 || (rule == RENJU && pos.get_turn() == BLACK
+                     && pos.check_forbidden_move(move)));
+
+        pos.move(move);
+        game.push_back(move);
+
+        const bool allowLong = allow_long_connection(rule, ColorFromMove(move));
+        if (pos.check_five_in_line_lastmove(allowLong))
+            break;
+    }
+
+    return game;
+}
+
+// Times Repeats runs of f(), which does ops operations each time
+template <typename F> static void time_ops(BenchResult &result, long ops, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < Repeats; r++)
+        f();
+    auto end = std::chrono::steady_clock::now();
+
+    result.ns += std::chrono::duration<double, std::nano>(end - start).count();
+    result.ops += ops * Repeats;
+}
+
+// Benchmarks one game, snapshots[i] being the position after the first i moves
+static void bench_game(BenchResult *             results,
+                       const std::vector<move_t> &game,
+                       GameRule                   rule,
+                       std::vector<Position> &    snapshots,
+                       int *                      mismatches)
+{
+    const int n = (int)game.size();
+
+    time_ops(results[BENCH_MOVE], n, [&] {
+        Position pos = snapshots[0];
+        for (move_t m : game)
+            pos.move(m);
+        sink = pos.get_move_count();
+    });
+
+    time_ops(results[BENCH_MOVE_WITH_COPY], n, [&] {
+        static Position buffer[2];
+        buffer[0] = snapshots[0];
+        for (int i = 0; i < n; i++)
+            buffer[(i + 1) & 1].move_with_copy(buffer[i & 1], game[i]);
+        sink = buffer[n & 1].get_move_count();
+    });
+
+    time_ops(results[BENCH_FIVE_LASTMOVE], n, [&] {
+        int found = 0;
+        for (int i = 1; i <= n; i++)
+            found += snapshots[i].check_five_in_line_lastmove(
+                allow_long_connection(rule, ColorFromMove(game[i - 1])));
+        sink = found;
+    });
+
+    // the last move path must agree with a full board scan of the side of the last move
+    for (int i = 1; i <= n; i++) {
+        const Color side      = ColorFromMove(game[i - 1]);
+        const bool  allowLong = allow_long_connection(rule, side);
+        mismatches[CHECK_FIVE_LASTMOVE] +=
+            snapshots[i].check_five_in_line_lastmove(allowLong)
+            != snapshots[i].check_five_in_line_side_ref(side, allowLong);
+    }
+
+    // The forbidden point cache would serve every repeat after the first one, so each
+    // empty point of the positions with black to move is checked once instead, starting
+    // from an empty cache: random_game() went through the same positions. The reference
+    // finder has no cache.
+    if (rule == RENJU) {
+        const int size = snapshots[0].get_size();
+
+        auto timeForbidden = [&](BenchResult &result, bool ref) {
+            int  found = 0;
+            long ops   = 0;
+
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; i += 2)
+                for (int x = 0; x < size; x++)
+                    for (int y = 0; y < size; y++) {
+                        const move_t move = (BLACK << 10) | POS(x, y);
+                        if (snapshots[i].is_legal_move(move)) {
+                            found += ref ? snapshots[i].check_forbidden_move_ref(move)
+                                         : snapshots[i].check_forbidden_move(move);
+                            ops++;
+                        }
+                    }
+            auto end = std::chrono::steady_clock::now();
+
+            sink = found;
+            result.ns += std::chrono::duration<double, std::nano>(end - start).count();
+            result.ops += ops;
+        };
+
+        forbidden_cache_clear();
+        timeForbidden(results[BENCH_FORBIDDEN], false);
+        timeForbidden(results[BENCH_FORBIDDEN_REF], true);
+
+        // the line bitboard finder must agree with the reference finder, on both colors
+        // to move, outside of the timing
+        for (int i = 0; i < n; i++)
+            for (int x = 0; x < size; x++)
+                for (int y = 0; y < size; y++) {
+                    const move_t move = (BLACK << 10) | POS(x, y);
+                    if (!snapshots[i].is_legal_move(move))
+                        continue;
+
+                    mismatches[CHECK_FORBIDDEN] +=
+                        snapshots[i].check_forbidden_move(move)
+                        != snapshots[i].check_forbidden_move_ref(move);
+
+                    // the classifier of the finder, for both colors, on the positions
+                    // with black to move only, the reference walks being slow
+                    for (Color c : {BLACK, WHITE})
+                        if (i % 2 == 0)
+                            mismatches[CHECK_LINE_PATTERNS] +=
+                                snapshots[i].check_line_patterns_ref(
+                                    (c << 10) | PosFromMove(move));
+                }
+    }
+
+    // Transforms compose, so the positions are transformed in place again and again
+    std::vector<Position> transformed(snapshots.begin(), snapshots.begin() + n + 1);
+    int                   type = 0;
+    time_ops(results[BENCH_TRANSFORM], n + 1, [&] {
+        for (Position &pos : transformed)
+            pos.transform((TransformType)(type++ % NB_TRANS));
+    });
+
+    const Position &  opening    = snapshots[std::min(n, OpeningPlies)];
+    const std::string openingStr = opening.to_opening_str(OPENING_OFFSET);
+    time_ops(results[BENCH_OPENING], 1, [&] {
+        Position pos(opening.get_size());
+        sink = pos.apply_opening(openingStr, OPENING_OFFSET);
+    });
+
+    // Full board scans of both sides, by the reference walk and then each kernel
+    auto scan = [&](bool ref) {
+        int found = 0;
+        for (int i = 0; i <= n; i++)
+            for (Color side : {BLACK, WHITE}) {
+                const bool allowLong = allow_long_connection(rule, side);
+                found += ref ? snapshots[i].check_five_in_line_side_ref(side, allowLong)
+                             : snapshots[i].check_five_in_line_side(side, allowLong);
+            }
+        sink = found;
+    };
+
+    time_ops(results[BENCH_FIVE_WALK], 2 * (n + 1), [&] { scan(true); });
+
+    const ScanKernel best = scan_kernel();
+    for (int k = 0; k < NB_SCAN_KERNEL; k++) {
+        if (!scan_kernel_supported((ScanKernel)k))
+            continue;
+        scan_kernel_set((ScanKernel)k);
+
+        // every kernel must agree with the reference walk
+        for (int i = 0; i <= n; i++)
+            for (Color side : {BLACK, WHITE})
+                for (bool allowLong : {true, false})
+                    mismatches[CHECK_FIVE_SCAN] +=
+                        snapshots[i].check_five_in_line_side(side, allowLong)
+                        != snapshots[i].check_five_in_line_side_ref(side, allowLong);
+
+        time_ops(results[BENCH_FIVE_SCAN + k], 2 * (n + 1), [&] { scan(false); });
+    }
+    scan_kernel_set(best);
+}
+
+static void print_result(bool &             first,
+                         const char *       function,
+                         const char *       kernel,
+                         int                size,
+                         const char *       rule,
+                         const BenchResult &result)
+{
+    printf("%s\n    {\"function\": \"%s\", ", first ? "" : ",", function);
+    if (kernel)
+        printf("\"kernel\": \"%s\", ", kernel);
+    printf("\"size\": %d, \"rule\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.2f, "
+           "\"ops_per_sec\": %.0f}",
+           size,
+           rule,
+           result.ops,
+           result.ns / result.ops,
+           result.ops * 1e9 / result.ns);
+    first = false;
+}
+
+int main()
+{
+    initZobrish();
+
+    uint64_t seed       = 0;
+    int      mismatches[NB_BENCH_CHECK] = {0};
+    bool     first      = true;
+
+    printf("{\n  \"games_per_case\": %d,\n  \"repeats\": %d,\n", GamesPerCase, Repeats);
+    printf("  \"scan_kernel\": \"%s\",\n  \"results\": [", ScanKernelName[scan_kernel()]);
+
+    for (const auto &rule : Rules)
+        for (int size = 15; size <= Position::RealBoardSize; size++) {
+            BenchResult           results[NB_BENCH_FUNCTION];
+            std::vector<Position> snapshots;
+
+            for (int g = 0; g < GamesPerCase; g++) {
+                const std::vector<move_t> game = random_game(size, rule.rule, seed);
+
+                snapshots.assign(1, Position(size));
+                for (move_t m : game) {
+                    snapshots.push_back(snapshots.back());
+                    snapshots.back().move(m);
+                }
+
+                bench_game(results, game, rule.rule, snapshots, mismatches);
+            }
+
+            for (int f = 0; f < NB_BENCH_FUNCTION; f++) {
+                if (!results[f].ops)
+                    continue;
+                else if (f < BENCH_FIVE_SCAN)
+                    print_result(first,
+                                 BenchFunctionName[f],
+                                 nullptr,
+                                 size,
+                                 rule.name,
+                                 results[f]);
+                else
+                    print_result(first,
+                                 "check_five_in_line_side",
+                                 ScanKernelName[f - BENCH_FIVE_SCAN],
+                                 size,
+                                 rule.name,
+                                 results[f]);
+            }
+        }
+
+    int total = 0;
+    printf("\n  ],\n  \"mismatches\": {");
+    for (int c = 0; c < NB_BENCH_CHECK; c++) {
+        printf("%s\"%s\": %d", c ? ", " : "", BenchCheckName[c], mismatches[c]);
+        total += mismatches[c];
+    }
+    printf("}\n}\n");
+
+    return total ? 1 : 0;
+}
@@ -0,0 +1,358 @@
+/*
+ *  c-gomoku-cli, a command line interface for Gomocup engines. Copyright 2021 Chao Ma.
+ *  c-gomoku-cli is derived from c-chess-cli, originally authored by lucasart 2020.
+ *
+ *  c-gomoku-cli is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ *  c-gomoku-cli is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this
+ * program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "checkpoint.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#ifdef __MINGW32__
+    #include <io.h>
+    #define fsync _commit
+#else
+    #include <unistd.h>
+#endif
+
+static const char *Header = "c-gomoku-cli checkpoint";
+
+Checkpoint::Checkpoint(const std::string &fileName_, int64_t interval_, JobQueue *jq_)
+    : fileName(fileName_)
+    , interval(interval_)
+    , jq(jq_)
+    , lastSaved(system_msec())
+    , finished(jq_->job_count())
+{}
+
+static void read_line(std::string &line, FILE *in)
+{
+    if (!string_getline(line, in))
+        DIE("unexpected end of checkpoint\n");
+}
+
+bool Checkpoint::load()
+{
+    FILE *in = fopen(fileName.c_str(), "r" FOPEN_BINARY);
+    if (!in)
+        return false;
+
+    std::string line;
+    read_line(line, in);
+    if (line != Header)
+        DIE("'%s' is not a checkpoint\n", fileName.c_str());
+
+    size_t jobCount = 0;
+    read_line(line, in);
+    if (sscanf(line.c_str(),
+               "jobs %zu seed %" SCNu64 " shard %d %d",
+               &jobCount,
+               &seed,
+               &shard,
+               &shards)
+            != 4
+        || jobCount != finished.size() || shard < 1 || shard > shards)
+        DIE("checkpoint '%s' is of another tournament\n", fileName.c_str());
+
+    results.resize(jq->results.size());
+    names.resize(jq->names.size());
+
+    while (string_getline(line, in)) {
+        size_t p, first, last, idxNext, records;
+        int    ei[2], count[3], pathPos = 0;
+        long   size;
+        char   name[16];
+
+        if (sscanf(line.c_str(), "engine %d %n", &ei[0], &pathPos) == 1 && pathPos) {
+            if (ei[0] < 0 || ei[0] >= (int)names.size())
+                DIE("checkpoint '%s' is of another tournament\n", fileName.c_str());
+            names[ei[0]] = line.substr(pathPos);
+        }
+        else if (sscanf(line.c_str(),
+                        "result %zu %d %d %d %d %d",
+                        &p,
+                        &ei[0],
+                        &ei[1],
+                        &count[0],
+                        &count[1],
+                        &count[2])
+                 == 6) {
+            if (p >= results.size() || ei[0] != jq->results[p].ei[0]
+                || ei[1] != jq->results[p].ei[1])
+                DIE("checkpoint '%s' is of another tournament\n", fileName.c_str());
+            results[p] = Result::pack(count);
+        }
+        else if (sscanf(line.c_str(), "done %zu %zu", &first, &last) == 2) {
+            if (first > last || last >= finished.size())
+                DIE("illegal game range in checkpoint: '%s'\n", line.c_str());
+            std::fill(finished.begin() + first, finished.begin() + last + 1, 1);
+        }
+        else if (sscanf(line.c_str(),
+                        "output %15s %ld %zu %zu %n",
+                        name,
+                        &size,
+                        &idxNext,
+                        &records,
+                        &pathPos)
+                     == 4
+                 && pathPos) {
+            CheckpointOutput output = {name, line.substr(pathPos), {size, idxNext, {}}};
+
+            // Records held back, each one a header line followed by the record itself
+            for (size_t i = 0; i < records; i++) {
+                size_t idx, len;
+                read_line(line, in);
+                if (sscanf(line.c_str(), "record %zu %zu", &idx, &len) != 2)
+                    DIE("illegal record in checkpoint: '%s'\n", line.c_str());
+
+                std::string str(len, '\0');
+                if (fread(str.data(), 1, len, in) != len || getc(in) != '\n')
+                    DIE("unexpected end of checkpoint\n");
+                output.state.buf.emplace_back(idx, str);
+            }
+
+            outputs.push_back(std::move(output));
+        }
+        else
+            DIE("illegal line in checkpoint: '%s'\n", line.c_str());
+    }
+
+    DIE_IF(0, fclose(in) < 0);
+    return true;
+}
+
+void Checkpoint::add_writer(const char *name, const std::string &path, SeqWriter *writer)
+{
+    writers.push_back({name, path, writer});
+}
+
+void Checkpoint::add_samples(const std::string &path, long (*sync)(void))
+{
+    samplesPath = path;
+    syncSamples = sync;
+}
+
+static CheckpointOutput *find_output(std::vector<CheckpointOutput> &outputs,
+                                     const std::string &            name)
+{
+    for (CheckpointOutput &output : outputs)
+        if (output.name == name)
+            return &output;
+    return nullptr;
+}
+
+// The run must resume with the same output files, which are cut back to their size at
+// the checkpoint
+void Checkpoint::restore(FILE *sampleFile)
+{
+    for (size_t p = 0; p < results.size(); p++)
+        jq->results[p].packed.store(results[p]);
+    for (size_t ei = 0; ei < names.size(); ei++)
+        if (!names[ei].empty())
+            jq->set_name((int)ei, names[ei]);
+    jq->resume(finished);
+
+    if (outputs.size() != writers.size() + (sampleFile != nullptr))
+        DIE("checkpoint '%s' has other output files\n", fileName.c_str());
+
+    for (Writer &w : writers) {
+        CheckpointOutput *output = find_output(outputs, w.name);
+        if (!output)
+            DIE("checkpoint '%s' has no %s output\n", fileName.c_str(), w.name.c_str());
+        w.writer->restore(std::move(output->state));
+    }
+
+    if (sampleFile) {
+        CheckpointOutput *output = find_output(outputs, "samples");
+        if (!output)
+            DIE("checkpoint '%s' has no samples output\n", fileName.c_str());
+        file_truncate(sampleFile, output->state.size);
+    }
+
+    outputs.clear();
+}
+
+// Called by workers after each game: the first one to see the interval elapsed saves
+void Checkpoint::save_if_due()
+{
+    const int64_t now  = system_msec();
+    int64_t       last = lastSaved.load(std::memory_order_relaxed);
+
+    if (now - last >= interval && lastSaved.compare_exchange_strong(last, now))
+        save();
+}
+
+void Checkpoint::save()
+{
+    std::lock_guard saveLock(saveMtx);
+    std::string     out = format("%s\njobs %zu seed %" PRIu64 " shard %d %d\n",
+                             Header,
+                             finished.size(),
+                             seed,
+                             shard,
+                             shards);
+
+    {
+        // No game is being recorded meanwhile
+        std::unique_lock lock(mtx);
+
+        for (size_t ei = 0; ei < jq->names.size(); ei++)
+            if (const std::string name = jq->get_name((int)ei); !name.empty())
+                out += format("engine %zu %s\n", ei, name.c_str());
+
+        for (size_t p = 0; p < jq->results.size(); p++) {
+            int count[3];
+            Result::unpack(jq->results[p].packed.load(), count);
+            out += format("result %zu %d %d %d %d %d\n",
+                          p,
+                          jq->results[p].ei[0],
+                          jq->results[p].ei[1],
+                          count[0],
+                          count[1],
+                          count[2]);
+        }
+
+        // Finished games, as ranges of consecutive indices
+        for (size_t first = 0; first < finished.size(); first++)
+            if (finished[first]) {
+                size_t last = first;
+                while (last + 1 < finished.size() && finished[last + 1])
+                    last++;
+                out += format("done %zu %zu\n", first, last);
+                first = last;
+            }
+
+        for (Writer &w : writers) {
+            const SeqWriterState state = w.writer->state();
+            out += format("output %s %ld %zu %zu %s\n",
+                          w.name.c_str(),
+                          state.size,
+                          state.idxNext,
+                          state.buf.size(),
+                          w.path.c_str());
+            for (const SeqStr &record : state.buf) {
+                out += format("record %zu %zu\n", record.idx, record.str.size());
+                out += record.str;
+                out += '\n';
+            }
+        }
+
+        if (syncSamples)
+            out += format("output samples %ld 0 0 %s\n",
+                          syncSamples(),
+                          samplesPath.c_str());
+    }
+
+    // Written to a temporary file first, so that the checkpoint is never left half written
+    const std::string tmpName = fileName + ".tmp";
+    FILE *            f       = fopen(tmpName.c_str(), "w" FOPEN_BINARY);
+    DIE_IF(0, !f);
+    DIE_IF(0, fwrite(out.data(), 1, out.size(), f) != out.size());
+    DIE_IF(0, fflush(f) < 0);
+    DIE_IF(0, fsync(fileno(f)) < 0);
+    DIE_IF(0, fclose(f) < 0);
+    DIE_IF(0, rename(tmpName.c_str(), fileName.c_str()) < 0);
+}
+
+// Output file of a shard, next to its checkpoint, whatever directory it was written in
+static std::string shard_output_path(const std::string &checkpoint,
+                                     const std::string &path)
+{
+    const size_t dirEnd  = checkpoint.find_last_of('/');
+    const size_t baseBeg = path.find_last_of('/');
+
+    return (dirEnd == std::string::npos ? "" : checkpoint.substr(0, dirEnd + 1))
+           + path.substr(baseBeg == std::string::npos ? 0 : baseBeg + 1);
+}
+
+void Checkpoint::merge(const std::vector<std::string> &                         files,
+                       JobQueue *                                               jq,
+                       const std::vector<std::pair<std::string, std::string>> &outputs)
+{
+    const int                                n = (int)files.size();
+    std::vector<std::unique_ptr<Checkpoint>> parts(n);  // by shard
+    uint64_t                                 seed = 0;
+
+    for (const std::string &file : files) {
+        auto c = std::make_unique<Checkpoint>(file, 0, jq);
+        if (!c->load())
+            DIE("no checkpoint '%s'\n", file.c_str());
+        if (c->shards != n)
+            DIE("'%s' is a shard of %d, not %d\n", file.c_str(), c->shards, n);
+        if (parts[c->shard - 1])
+            DIE("'%s' is shard %d of %d again\n", file.c_str(), c->shard, n);
+        if (&file != &files[0] && c->seed != seed)
+            DIE("'%s' has another openings order\n", file.c_str());
+        seed = c->seed;
+
+        const size_t first = jq->shard_first(c->shard, n);
+        const size_t last  = jq->shard_first(c->shard + 1, n);
+        if (std::count(c->finished.begin() + first, c->finished.begin() + last, 1)
+            != (long)(last - first))
+            DIE("shard %d of %d is not finished: resume it first\n", c->shard, n);
+
+        parts[c->shard - 1] = std::move(c);
+    }
+
+    for (size_t p = 0; p < jq->results.size(); p++) {
+        int total[3] = {0};
+        for (const auto &c : parts) {
+            int count[3];
+            Result::unpack(c->results[p], count);
+            for (int i = 0; i < 3; i++)
+                total[i] += count[i];
+        }
+        jq->results[p].packed.store(Result::pack(total));
+    }
+
+    for (const auto &c : parts)
+        for (size_t ei = 0; ei < c->names.size(); ei++)
+            if (!c->names[ei].empty())
+                jq->set_name((int)ei, c->names[ei]);
+
+    jq->resume(std::vector<uint8_t>(jq->job_count(), 1));
+
+    // Shards are contiguous slices of the game indices: their files put end to end are
+    // those of a single run
+    for (const auto &[name, path] : outputs) {
+        FILE *out = fopen(path.c_str(), "w" FOPEN_BINARY);
+        DIE_IF(0, !out);
+
+        for (const auto &c : parts) {
+            CheckpointOutput *output = find_output(c->outputs, name);
+            if (!output)
+                DIE("shard %d of %d has no %s output\n", c->shard, n, name.c_str());
+            assert(output->state.buf.empty());  // all written, the shard being finished
+
+            const std::string inPath = shard_output_path(c->fileName, output->path);
+            FILE *            in     = fopen(inPath.c_str(), "r" FOPEN_BINARY);
+            DIE_IF(0, !in);
+
+            char buf[65536];
+            for (long left = output->state.size; left > 0;) {
+                const size_t len = fread(buf, 1, std::min<long>(left, sizeof(buf)), in);
+                if (!len)
+                    DIE("'%s' is shorter than in its checkpoint\n", inPath.c_str());
+                DIE_IF(0, fwrite(buf, 1, len, out) != len);
+                left -= (long)len;
+            }
+
+            DIE_IF(0, fclose(in) < 0);
+        }
+
+        DIE_IF(0, fclose(out) < 0);
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ *  c-gomoku-cli, a command line interface for Gomocup engines. Copyright 2021 Chao Ma.
+ *  c-gomoku-cli is derived from c-chess-cli, originally authored by lucasart 2020.
+ *
+ *  c-gomoku-cli is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ *  c-gomoku-cli is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this
+ * program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "jobs.h"
+#include "seqwriter.h"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// Output file in a checkpoint, as loaded. The sample file is named "samples", and has no
+// records held back.
+struct CheckpointOutput
+{
+    std::string    name, path;
+    SeqWriterState state;
+};
+
+// Checkpoint of a run, saved periodically to a file (replaced atomically), from which an
+// interrupted run is resumed: which games are finished, the results of each pair, the
+// seed of the openings shuffle, and how far each output file is written. Workers record
+// the outcome and output of a game within a game_scope(), so that a checkpoint never
+// holds part of a game. The checkpoints of the shards of a run are also what merge()
+// puts together.
+class Checkpoint
+{
+public:
+    Checkpoint(const std::string &fileName, int64_t interval, JobQueue *jq);
+
+    // Reads the checkpoint file, false if there is none. What it holds is restored by
+    // restore(), once the output files are opened and added.
+    bool load();
+    void add_writer(const char *name, const std::string &path, SeqWriter *writer);
+    void add_samples(const std::string &path, long (*sync)(void));
+    void restore(FILE *sampleFile);
+
+    std::shared_lock<std::shared_mutex> game_scope() { return std::shared_lock(mtx); }
+    void game_done(size_t idx) { finished[idx] = 1; }  // within game_scope()
+
+    void save_if_due();
+    void save();
+
+    // Merges the checkpoints of all the shards of a run into jq, and their output files
+    // (found next to each checkpoint) into outputs (name and path), as a single run
+    static void merge(const std::vector<std::string> &                         files,
+                      JobQueue *                                               jq,
+                      const std::vector<std::pair<std::string, std::string>> &outputs);
+
+    uint64_t seed  = 0;  // of the openings shuffle
+    int      shard = 1, shards = 1;  // the run is shard k (from 1) of n
+
+private:
+    struct Writer
+    {
+        std::string name, path;
+        SeqWriter * writer;
+    };
+
+    const std::string    fileName;
+    const int64_t        interval;  // in msec
+    JobQueue *const      jq;
+    std::shared_mutex    mtx;      // held exclusively while taking a checkpoint
+    std::mutex           saveMtx;  // one save at a time
+    std::atomic<int64_t> lastSaved;
+    std::vector<uint8_t> finished;  // by game index
+    std::vector<Writer>  writers;
+    std::string          samplesPath;
+    long (*syncSamples)(void) = nullptr;  // flushes the sample file, returns its size
+
+    // Loaded, until restore()
+    std::vector<uint64_t>         results;  // packed counts
+    std::vector<std::string>      names;    // of engines, empty if unknown
+    std::vector<CheckpointOutput> outputs;
+};
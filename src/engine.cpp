@@ -21,25 +21,35 @@
 #elif defined(__linux__)
     #define _GNU_SOURCE
     #include <fcntl.h>
+    #include <sched.h>
     #include <sys/prctl.h>
+    #include <sys/resource.h>
+    #include <sys/stat.h>
     #include <sys/wait.h>
     #include <unistd.h>
 #else
+    #include <sys/resource.h>
     #include <sys/wait.h>
     #include <unistd.h>
 #endif
 
 #include "engine.h"
 #include "position.h"
+#include "reactor.h"
 #include "util.h"
 #include "workers.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <signal.h>
 #include <sstream>
@@ -89,11 +99,185 @@ static std::string argvQuote(std::string_view arg)
 }
 #endif
 
-Engine::Engine(Worker *worker, bool debug, std::string *outmsg)
+const char *SpawnModeName[NB_SPAWN_MODE] = {"vfork", "fork"};
+
+const char *MemLimitModeName[NB_MEMLIMIT_MODE] = {"none", "cgroup", "rlimit"};
+
+static MemLimitMode memLimitMode = MEMLIMIT_NONE;
+static std::string  cgroupRoot;  // engine cgroups are created in it
+
+// Address space beyond maxmemory granted by RLIMIT_AS, for code, libraries, and the
+// reserved but mostly untouched thread stacks and malloc arenas
+static const int64_t RlimitRoom = 256LL << 20;
+
+#ifdef __linux__
+static bool write_file(const std::string &fileName, const char *s)
+{
+    const int fd = open(fileName.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    const bool ok = write(fd, s, strlen(s)) == (ssize_t)strlen(s);
+    return close(fd) == 0 && ok;
+}
+
+// Directory of the cgroup of the process, in the cgroup v2 hierarchy
+static std::string cgroup_self()
+{
+    std::string mountPoint, path, line;
+
+    if (FILE *f = fopen("/proc/self/mountinfo", "r" FOPEN_TEXT)) {
+        while (string_getline(line, f))
+            if (strstr(line.c_str(), " - cgroup2 ")) {
+                char dir[4096];
+                if (sscanf(line.c_str(), "%*s %*s %*s %*s %4095s", dir) == 1)
+                    mountPoint = dir;
+                break;
+            }
+        fclose(f);
+    }
+
+    if (FILE *f = fopen("/proc/self/cgroup", "r" FOPEN_TEXT)) {
+        while (string_getline(line, f))
+            if (const char *tail = string_prefix(line.c_str(), "0::"))
+                path = tail;
+        fclose(f);
+    }
+
+    return mountPoint.empty() || path.empty() ? "" : mountPoint + path;
+}
+#endif
+
+MemLimitMode memlimit_init(const std::string &cgroupDir)
+{
+#if defined(__MINGW32__)
+    DIE("memory limits are not available on Windows\n");
+#elif defined(__linux__)
+    // A probe cgroup must get memory.max: the memory controller has to be enabled for
+    // the children of the root, which the kernel only allows when no process is in it.
+    // It is only enabled in the cgroup given by the user, not in our own.
+    cgroupRoot = cgroupDir.empty() ? cgroup_self() : cgroupDir;
+    if (!cgroupRoot.empty()) {
+        if (!cgroupDir.empty())
+            write_file(cgroupRoot + "/cgroup.subtree_control", "+memory");
+
+        const std::string probe = format("%s/c-gomoku-cli.%d", cgroupRoot, getpid());
+        if (mkdir(probe.c_str(), 0755) == 0) {
+            const bool ok = access((probe + "/memory.max").c_str(), W_OK) == 0;
+            rmdir(probe.c_str());
+            if (ok)
+                return memLimitMode = MEMLIMIT_CGROUP;
+        }
+    }
+
+    if (!cgroupDir.empty())
+        DIE("cannot create cgroups with a memory limit in '%s'\n", cgroupDir.c_str());
+#else
+    (void)cgroupDir;
+#endif
+
+    return memLimitMode = MEMLIMIT_RLIMIT;
+}
+
+#ifndef __MINGW32__
+// Engines killed by force are not waited for, as the deadline callbacks must not block.
+// They are reaped later, and their cgroup, which can only be removed then, with them.
+// One still alive after KillGrace msec gets SIGKILL.
+struct KilledEngine
+{
+    pid_t       pid;
+    std::string cgroup;
+    int64_t     killTime;
+    bool        sigkill;
+};
+
+static const int64_t             KillGrace = 1000;
+static std::mutex                killedMtx;
+static std::vector<KilledEngine> killedEngines;
+
+void engine_reap_killed(bool wait)
+{
+    std::lock_guard lock(killedMtx);
+
+    for (size_t i = 0; i < killedEngines.size();) {
+        KilledEngine &k = killedEngines[i];
+
+        if (wait && !k.sigkill) {
+            kill(k.pid, SIGKILL);
+            k.sigkill = true;
+        }
+
+        const pid_t reaped = waitpid(k.pid, NULL, wait ? 0 : WNOHANG);
+        if (reaped == k.pid || (reaped < 0 && errno == ECHILD)) {
+            if (!k.cgroup.empty())
+                rmdir(k.cgroup.c_str());
+            killedEngines[i] = std::move(killedEngines.back());
+            killedEngines.pop_back();
+            continue;
+        }
+
+        if (!k.sigkill && system_msec() - k.killTime > KillGrace) {
+            kill(k.pid, SIGKILL);
+            k.sigkill = true;
+        }
+        i++;
+    }
+}
+#else
+void engine_reap_killed(bool) {}
+#endif
+
+#ifndef __MINGW32__
+// Restrictions applied to the child between fork and exec
+struct ChildLimits
+{
+    #ifdef __linux__
+    const cpu_set_t *cpus;  // nullptr if not pinned
+    #endif
+    int                  cgroupProcs;   // cgroup.procs of its cgroup, -1 if none
+    const struct rlimit *addressSpace;  // nullptr if not limited
+};
+
+// Returns false, with errno set, if a restriction failed
+static bool apply_child_limits(const ChildLimits &l)
+{
+    #ifdef __linux__
+    if (l.cpus && sched_setaffinity(0, sizeof(cpu_set_t), l.cpus) < 0)
+        return false;
+    #endif
+    // "0" moves the writing process
+    if (l.cgroupProcs >= 0 && write(l.cgroupProcs, "0", 1) < 0)
+        return false;
+    return !l.addressSpace || setrlimit(RLIMIT_AS, l.addressSpace) == 0;
+}
+#endif
+
+void EngineUsage::add_move(int64_t moveTime, const Usage &u)
+{
+    moves++;
+    time += moveTime;
+    cpuMsec += u.userMsec + u.sysMsec;
+    peakRssKB = std::max(peakRssKB, u.rssKB);
+}
+
+void EngineUsage::add(const EngineUsage &other)
+{
+    moves += other.moves;
+    time += other.time;
+    cpuMsec += other.cpuMsec;
+    peakRssKB = std::max(peakRssKB, other.peakRssKB);
+    exitCpuMsec += other.exitCpuMsec;
+}
+
+Engine::Engine(Worker *worker, bool debug, std::string *outmsg, SpawnMode mode)
     : w(worker)
     , isDebug(debug)
+    , spawnMode(mode)
     , pid(0)
+    , out(nullptr)
+    , batching(false)
     , messages(outmsg)
+    , statFd(-1)
+    , memLimit(0)
 {}
 
 Engine::~Engine()
@@ -101,6 +285,66 @@ Engine::~Engine()
     terminate();
 }
 
+#ifdef __linux__
+// Arguments of the vfork child, which shares the memory of the parent until it execs
+struct VforkChild
+{
+    const char *     cwd, *run;
+    const char **       argv;
+    int                 in, out;
+    bool                readStdErr;
+    const ChildLimits * limits;
+    int                 error;  // errno of the failed call, seen by the parent
+};
+
+static int vfork_child_main(void *arg)
+{
+    VforkChild *c = (VforkChild *)arg;
+
+    // Same setup as the fork child in Engine::spawn(), reporting errors to the parent
+    // instead of dying, as the child only owns its stack.
+    prctl(PR_SET_PDEATHSIG, SIGHUP);
+    signal(SIGPIPE, SIG_DFL);  // ignored by the parent
+    if (apply_child_limits(*c->limits) && dup2(c->in, STDIN_FILENO) >= 0
+        && dup2(c->out, STDOUT_FILENO) >= 0
+        && (!c->readStdErr || dup2(c->out, STDERR_FILENO) >= 0) && chdir(c->cwd) >= 0)
+        execvp(c->run, const_cast<char *const *>(c->argv));
+
+    c->error = errno;
+    _exit(EXIT_FAILURE);
+}
+
+// Launches the child with clone(CLONE_VM | CLONE_VFORK), like posix_spawn() does: the
+// parent is suspended until the child execs or exits, and no page table is copied.
+// posix_spawn() itself has no way to set PR_SET_PDEATHSIG in the child.
+static pid_t spawn_vfork(Worker *           w,
+                         const char *       cwd,
+                         const char *       run,
+                         const char **      argv,
+                         int                in,
+                         int                out,
+                         bool               readStdErr,
+                         const ChildLimits &limits)
+{
+    static const size_t StackSize = 64 * 1024;
+
+    VforkChild              child = {cwd, run, argv, in, out, readStdErr, &limits, 0};
+    std::unique_ptr<char[]> stack(new char[StackSize]);
+
+    const int   flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+    const pid_t pid   = clone(vfork_child_main, stack.get() + StackSize, flags, &child);
+    DIE_IF(w->id, pid < 0);
+
+    if (child.error) {
+        waitpid(pid, NULL, 0);
+        errno = child.error;
+        DIE_IF(w->id, true);
+    }
+
+    return pid;
+}
+#endif
+
 void Engine::spawn(const char *cwd, const char *run, const char **argv, bool readStdErr)
 {
     assert(argv[0]);
@@ -220,7 +464,7 @@ void Engine::spawn(const char *cwd, const char *run, const char **argv, bool rea
     int stdout_fd = _open_osfhandle((intptr_t)p_stdout[0], _O_TEXT);
     DIE_IF(w->id, stdin_fd == -1);
     DIE_IF(w->id, stdout_fd == -1);
-    DIE_IF(w->id, !(this->in = _fdopen(stdout_fd, "r")));
+    this->in.open(stdout_fd);
     DIE_IF(w->id, !(this->out = _fdopen(stdin_fd, "w")));
 
     // Bind child process to the global job, so child process is killed when
@@ -241,12 +485,57 @@ void Engine::spawn(const char *cwd, const char *run, const char **argv, bool rea
     DIE_IF(w->id, pipe(into) < 0);
     #endif
 
-    DIE_IF(w->id, (this->pid = fork()) < 0);
+    ChildLimits limits = {};
+    limits.cgroupProcs = -1;
+
+    #ifdef __linux__
+    // Engines of the worker share its CPUs, and the threads they start inherit them
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : w->cpus)
+        CPU_SET(cpu, &cpus);
+    limits.cpus = w->cpus.empty() ? nullptr : &cpus;
+
+    // Each process gets a new cgroup, so that its OOM kills are told apart
+    if (memLimit && memLimitMode == MEMLIMIT_CGROUP) {
+        static std::atomic<uint64_t> cgroupCount(0);
+        cgroup = format("%s/c-gomoku-cli.%d.%d.%" PRIu64,
+                        cgroupRoot,
+                        getpid(),
+                        w->id,
+                        cgroupCount++);
+
+        DIE_IF(w->id, mkdir(cgroup.c_str(), 0755) < 0);
+        DIE_IF(w->id,
+               !write_file(cgroup + "/memory.max", format("%" PRId64, memLimit).c_str()));
+        write_file(cgroup + "/memory.swap.max", "0");  // absent without swap accounting
+        const std::string procs = cgroup + "/cgroup.procs";
+        limits.cgroupProcs      = open(procs.c_str(), O_WRONLY | O_CLOEXEC);
+        DIE_IF(w->id, limits.cgroupProcs < 0);
+    }
+    #endif
+
+    struct rlimit addressSpace = {};
+    if (memLimit && memLimitMode == MEMLIMIT_RLIMIT) {
+        addressSpace.rlim_cur = addressSpace.rlim_max = memLimit + RlimitRoom;
+        limits.addressSpace                           = &addressSpace;
+    }
+
+    #ifdef __linux__
+    if (spawnMode == SPAWN_VFORK)
+        this->pid =
+            spawn_vfork(w, cwd, run, argv, into[0], outof[1], readStdErr, limits);
+    else
+    #endif
+        DIE_IF(w->id, (this->pid = fork()) < 0);
 
     if (this->pid == 0) {
     #ifdef __linux__
         prctl(PR_SET_PDEATHSIG, SIGHUP);  // delegate zombie purge to the kernel
     #endif
+        signal(SIGPIPE, SIG_DFL);  // ignored by the parent
+        DIE_IF(w->id, !apply_child_limits(limits));
+
         // Plug stdin and stdout
         DIE_IF(w->id, dup2(into[0], STDIN_FILENO) < 0);
         DIE_IF(w->id, dup2(outof[1], STDOUT_FILENO) < 0);
@@ -271,7 +560,7 @@ void Engine::spawn(const char *cwd, const char *run, const char **argv, bool rea
 
         // Set cwd as current directory, and execute run with argv[]
         DIE_IF(w->id, chdir(cwd) < 0);
-        DIE_IF(w->id, execvp(run, argv) < 0);
+        DIE_IF(w->id, execvp(run, const_cast<char *const *>(argv)) < 0);
     }
     else {
         assert(this->pid > 0);
@@ -279,13 +568,97 @@ void Engine::spawn(const char *cwd, const char *run, const char **argv, bool rea
         // in the parent process
         DIE_IF(w->id, close(into[0]) < 0);
         DIE_IF(w->id, close(outof[1]) < 0);
+        if (limits.cgroupProcs >= 0)
+            DIE_IF(w->id, close(limits.cgroupProcs) < 0);
+
+        // A fiber of the reactor must not block on reading the pipe
+        if (reactor_active())
+            DIE_IF(w->id, fcntl(outof[0], F_SETFL, O_NONBLOCK) < 0);
 
-        DIE_IF(w->id, !(this->in = fdopen(outof[0], "r")));
+        this->in.open(outof[0]);
         DIE_IF(w->id, !(this->out = fdopen(into[1], "w")));
+
+    #ifdef __linux__
+        // Kept open to sample the engine usage with a single pread() per move
+        const std::string statPath = format("/proc/%d/stat", this->pid);
+        this->statFd               = open(statPath.c_str(), O_RDONLY | O_CLOEXEC);
+    #endif
     }
 #endif
 }
 
+bool Engine::is_out_of_memory() const
+{
+    // An OOM kill is counted in memory.events before the process dies, so it is seen as
+    // soon as its pipe is closed. RLIMIT_AS only makes allocations fail instead, which an
+    // engine may handle in any way.
+    bool oom = false;
+
+#ifdef __linux__
+    if (!cgroup.empty())
+        if (FILE *f = fopen((cgroup + "/memory.events").c_str(), "r" FOPEN_TEXT)) {
+            std::string line;
+            while (string_getline(line, f))
+                if (const char *tail = string_prefix(line.c_str(), "oom_kill "))
+                    oom = atoll(tail) > 0;
+            fclose(f);
+        }
+#endif
+
+    return oom;
+}
+
+bool Engine::is_running() const
+{
+    if (!pid)
+        return false;
+
+#ifdef __MINGW32__
+    return WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT;
+#else
+    // WNOWAIT leaves the process to terminate(), which reaps it with its usage
+    siginfo_t info = {};
+    return waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && !info.si_pid;
+#endif
+}
+
+bool Engine::read_usage(Usage &u) const
+{
+#ifdef __linux__
+    static const int64_t TicksPerSec = sysconf(_SC_CLK_TCK);
+    static const int64_t PageKB      = sysconf(_SC_PAGESIZE) / 1024;
+
+    char    buf[512];
+    ssize_t n;
+    if (statFd < 0 || (n = pread(statFd, buf, sizeof(buf) - 1, 0)) <= 0)
+        return false;
+    buf[n] = '\0';
+
+    // Fields are counted after the command name, which may contain spaces: utime and
+    // stime are the 14th and 15th fields, rss the 24th
+    unsigned long long utime, stime;
+    long long          rss;
+    const char *       tail = strrchr(buf, ')');
+    if (!tail
+        || sscanf(tail + 1,
+                  " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
+                  " %*d %*d %*d %*d %*d %*d %*u %*u %lld",
+                  &utime,
+                  &stime,
+                  &rss)
+               != 3)
+        return false;
+
+    u.userMsec = (int64_t)utime * 1000 / TicksPerSec;
+    u.sysMsec  = (int64_t)stime * 1000 / TicksPerSec;
+    u.rssKB    = rss * PageKB;
+    return true;
+#else
+    (void)u;
+    return false;
+#endif
+}
+
 static void engine_parse_cmd(const char *              cmd,
                              std::string &             cwd,
                              std::string &             run,
@@ -332,13 +705,17 @@ static void engine_parse_cmd(const char *              cmd,
         args.push_back(token);
 }
 
-void Engine::start(const char *cmd, const char *engine_name, int64_t engine_tolerance)
+void Engine::start(const char *cmd,
+                   const char *engine_name,
+                   int64_t     engine_tolerance,
+                   int64_t     engine_memLimit)
 {
     if (!*cmd)
         DIE("[%d] missing command to start engine.\n", w->id);
 
     this->name      = engine_name;
     this->tolerance = engine_tolerance;
+    this->memLimit  = engine_memLimit;
 
     // Parse cmd into (cwd, run, args): we want to execute run from cwd with args.
     std::string              cwd, run;
@@ -355,12 +732,27 @@ void Engine::start(const char *cmd, const char *engine_name, int64_t engine_tole
     }
 
     // Spawn child process and plug pipes
+    const auto spawnStart = std::chrono::steady_clock::now();
     spawn(cwd.c_str(), run.c_str(), argv, w->log != NULL);
 
     free(argv);
 
     // parse engine ABOUT infomation
     parse_about(cmd);
+
+    const int64_t usec = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - spawnStart)
+                             .count();
+    w->spawnCount++;
+    w->spawnUsec += usec;
+    if (w->log)
+        DIE_IF(w->id,
+               fprintf(w->log,
+                       "spawn: %s answered ABOUT %.3f ms after %s\n",
+                       name.c_str(),
+                       usec / 1000.0,
+                       SpawnModeName[spawnMode])
+                   < 0);
 }
 
 void Engine::terminate(bool force)
@@ -385,37 +777,76 @@ void Engine::terminate(bool force)
         DIE_IF(w->id, !TerminateProcess(hProcess, 0));
     DIE_IF(w->id, !CloseHandle(hProcess));
 #else
+    struct rusage ru     = {};
+    pid_t         reaped = 0;
+
+    engine_reap_killed(false);
+
     if (force) {
-        if (waitpid(pid, NULL, WNOHANG) == 0)
+        if ((reaped = wait4(pid, NULL, WNOHANG, &ru)) == 0) {
             DIE_IF(w->id, kill(pid, SIGTERM) < 0);
+
+            std::lock_guard lock(killedMtx);
+            killedEngines.push_back({pid, cgroup, system_msec(), false});
+            cgroup.clear();  // removed once reaped
+        }
+    }
+    else if (reactor_active()) {
+        // Wait until deadline, letting the other fibers of the thread run meanwhile
+        while ((reaped = wait4(pid, NULL, WNOHANG, &ru)) == 0)
+            reactor_sleep(5);
     }
     else {
         // On unix/linux, wait until deadline
-        waitpid(pid, NULL, 0);
+        reaped = wait4(pid, NULL, 0, &ru);
+    }
+
+    #ifdef __linux__
+    if (reaped == pid) {
+        exited.exitCpuMsec += (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000
+                              + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000;
+        exited.peakRssKB = std::max<int64_t>(exited.peakRssKB, ru.ru_maxrss);
+    }
+    #endif
+
+    if (statFd >= 0) {
+        DIE_IF(w->id, close(statFd) < 0);
+        statFd = -1;
+    }
+
+    // The process is reaped: its cgroup is empty
+    if (!cgroup.empty()) {
+        rmdir(cgroup.c_str());
+        cgroup.clear();
     }
 #endif
 
     if (!force)
         w->deadline_clear();
 
-    if (in)
-        DIE_IF(w->id, fclose(in) < 0);
+    if (in.is_open())
+        DIE_IF(w->id, in.close() < 0);
     if (out)
         DIE_IF(w->id, fclose(out) < 0);
 
     // Reset pid, in, out
     pid = 0;
-    in = out = nullptr;
+    out = nullptr;
 }
 
 // returns false when engine timeout or crash, and after that
 // is_crashed() can be used to check if the engine has crashed
-bool Engine::readln(std::string &line)
+bool Engine::readln(std::string_view &line)
 {
-    if (!in)  // Check if engine has crashed
+    if (!in.is_open())  // Check if engine has crashed
         return false;
 
-    if (!string_getline(line, in)) {
+    // In reactor mode, the fiber is suspended until the pipe has more data
+    bool ok;
+    while (!(ok = in.getline(line)) && in.would_block())
+        reactor_wait_readable(in.get_fd());
+
+    if (!ok) {
         // When timeout, main thread will terminate the engine subprocess by force
         // We wait for main thread to complete the termination callback
         w->wait_callback_done();
@@ -423,15 +854,15 @@ bool Engine::readln(std::string &line)
         // Pipe returning EOF means engine crashed
         // Instead of dying instantly, close pipe to flag engine died and return false
         if (pid) {  // If it is terminated by timeout, process is already closed
-            DIE_IF(w->id, fclose(in) < 0);
+            DIE_IF(w->id, in.close() < 0);
             DIE_IF(w->id, fclose(out) < 0);
-            in = out = nullptr;
+            out = nullptr;
         }
         return false;
     }
 
     if (w->log)
-        DIE_IF(w->id, fprintf(w->log, "%s -> %s\n", name.c_str(), line.c_str()) < 0);
+        DIE_IF(w->id, fprintf(w->log, "%s -> %s\n", name.c_str(), line.data()) < 0);
 
     return true;
 }
@@ -441,26 +872,66 @@ void Engine::writeln(const char *buf)
     if (!out)  // Check if engine has crashed
         return;
 
-    DIE_IF(w->id, fputs(buf, out) < 0);
-    DIE_IF(w->id, fputc('\n', out) < 0);
+    outBuf += buf;
+    outBuf += '\n';
 
-    // We take fflush error as engine crashed signal
-    if (fflush(out) < 0) {
-        // Instead of dying instantly, close pipe to flag engine died
-        DIE_IF(w->id, fclose(in) < 0);
-        DIE_IF(w->id, fclose(out) < 0);
-        in = out = nullptr;
+    if (w->log)
+        DIE_IF(w->id, fprintf(w->log, "%s <- %s\n", name.c_str(), buf) < 0);
+
+    if (!batching)
+        flush_lines();
+}
+
+void Engine::batch_begin()
+{
+    batching = true;
+}
+
+void Engine::batch_end()
+{
+    batching = false;
+    flush_lines();
+}
+
+// Sends the pending lines with a single write, when the pipe can take them at once
+void Engine::flush_lines()
+{
+    if (out) {
+#ifdef __MINGW32__
+        // write through the CRT, which translates '\n' for the text mode pipe
+        bool ok = fwrite(outBuf.data(), 1, outBuf.size(), out) == outBuf.size()
+                  && fflush(out) == 0;
+#else
+        const int fd   = fileno(out);
+        bool      ok   = true;
+        size_t    done = 0;
+        while (ok && done < outBuf.size()) {
+            const ssize_t n = write(fd, outBuf.data() + done, outBuf.size() - done);
+            if (n >= 0)
+                done += n;
+            else
+                ok = errno == EINTR;
+        }
+#endif
+
+        // We take write error as engine crashed signal
+        if (!ok) {
+            // Instead of dying instantly, close pipe to flag engine died
+            DIE_IF(w->id, in.close() < 0);
+            DIE_IF(w->id, fclose(out) < 0);
+            out = nullptr;
+        }
     }
 
-    if (w->log) {
-        DIE_IF(w->id, fprintf(w->log, "%s <- %s\n", name.c_str(), buf) < 0);
+    outBuf.clear();
+
+    if (w->log)
         DIE_IF(w->id, fflush(w->log) < 0);
-    }
 }
 
 bool Engine::wait_for_ok(bool fatalError)
 {
-    std::string line;
+    std::string_view line;
     w->deadline_set(name.c_str(), system_msec() + tolerance, "start", [=] {
         if (!fatalError)
             terminate(true);
@@ -476,7 +947,7 @@ bool Engine::wait_for_ok(bool fatalError)
             break;
         }
 
-        if (const char *tail = string_prefix(line.c_str(), "ERROR")) {  // an ERROR
+        if (const char *tail = string_prefix(line.data(), "ERROR")) {  // an ERROR
             DIE_OR_ERR(fatalError,
                        "[%d] engine %s output error:%s\n",
                        w->id,
@@ -509,9 +980,11 @@ bool Engine::bestmove(int64_t &    timeLeft,
     w->deadline_set(name.c_str(), turnTimeLimit + tolerance, "move", [=] {
         terminate(true);
     });
-    int64_t     moveOverhead = std::min<int64_t>(tolerance / 2, 1000);
-    bool        result       = false;
-    std::string line;
+    Usage            before       = {};
+    const bool       sampled      = read_usage(before);
+    int64_t          moveOverhead = std::min<int64_t>(tolerance / 2, 1000);
+    bool             result       = false;
+    std::string_view line;
 
     while ((turnTimeLeft + moveOverhead) >= 0 && !result) {
         if (!readln(line))
@@ -523,15 +996,15 @@ bool Engine::bestmove(int64_t &    timeLeft,
         turnTimeLeft      = turnTimeLimit - now;
 
         if (isDebug)
-            process_message_ifneeded(line.c_str());
+            process_message_ifneeded(line.data());
 
-        if (const char *tail = string_prefix(line.c_str(), "MESSAGE")) {
+        if (const char *tail = string_prefix(line.data(), "MESSAGE")) {
             // record engine messages
             if (messages)
                 *messages += format("%i) %s: %s\n", moveply, name, tail + 1);
 
             // parse and store thing infomation to info
-            parse_thinking_messages(line.c_str(), info);
+            parse_thinking_messages(line.data(), info);
         }
         else if (Position::is_valid_move_gomostr(line)) {
             best   = line;
@@ -552,21 +1025,27 @@ bool Engine::bestmove(int64_t &    timeLeft,
                 goto Exit;
 
             if (isDebug)
-                process_message_ifneeded(line.c_str());
+                process_message_ifneeded(line.data());
 
-            if (const char *tail = string_prefix(line.c_str(), "MESSAGE")) {
+            if (const char *tail = string_prefix(line.data(), "MESSAGE")) {
                 // record engine messages
                 if (messages)
                     *messages += format("%i) %s: %s\n", moveply, name, tail + 1);
 
                 // parse and store thing infomation to info
-                parse_thinking_messages(line.c_str(), info);
+                parse_thinking_messages(line.data(), info);
             }
         } while (result = Position::is_valid_move_gomostr(line), !result);
     }
 
 Exit:
     w->deadline_clear();
+
+    if (Usage after; sampled && read_usage(after))
+        info.usage = {.userMsec = after.userMsec - before.userMsec,
+                      .sysMsec  = after.sysMsec - before.sysMsec,
+                      .rssKB    = after.rssKB};
+
     return result;
 }
 
@@ -648,7 +1127,7 @@ void Engine::parse_about(const char *fallbackName)
                     "about");
     writeln("ABOUT");
 
-    std::string line;
+    std::string_view line;
     if (!readln(line)) {
         DIE("[%d] engine %s exited before answering ABOUT\n", w->id, name.c_str());
     }
@@ -689,3 +1168,77 @@ void Engine::parse_thinking_messages([[maybe_unused]] const char *line, Info &in
     info.score = 0;
     info.depth = 0;
 }
+
+EnginePool::EnginePool(Worker *     worker,
+                       bool         debug,
+                       std::string *outmsg,
+                       SpawnMode    mode,
+                       size_t       idleCapacity)
+    : w(worker)
+    , isDebug(debug)
+    , messages(outmsg)
+    , spawnMode(mode)
+    , capacity(idleCapacity)
+{}
+
+EnginePool::~EnginePool()
+{
+    for (Slot &slot : idle)
+        drop(slot);
+    for (Slot &slot : busy)
+        drop(slot);
+}
+
+void EnginePool::drop(Slot &slot)
+{
+    slot.engine->terminate();
+    w->add_engine_usage(slot.ei, slot.engine->exited);
+}
+
+Engine *EnginePool::acquire(int         ei,
+                            const char *cmd,
+                            const char *name,
+                            int64_t     tolerance,
+                            int64_t     memLimit)
+{
+    auto it = std::find_if(idle.begin(), idle.end(), [=](const Slot &s) {
+        return s.ei == ei;
+    });
+
+    if (it != idle.end()) {
+        busy.push_back(std::move(*it));
+        idle.erase(it);
+
+        Engine *engine = busy.back().engine.get();
+        // Restart an engine which died while idle (crash, OOM kill), or whose pipes
+        // failed in its last game. A dead one is only reaped, END would hit a closed pipe.
+        const bool running = engine->is_running();
+        if (running && !engine->is_crashed())
+            w->restartsAvoided++;
+        else {
+            engine->terminate(!running);
+            engine->start(cmd, name, tolerance, memLimit);
+        }
+        return engine;
+    }
+
+    busy.push_back({std::make_unique<Engine>(w, isDebug, messages, spawnMode), ei});
+    busy.back().engine->start(cmd, name, tolerance, memLimit);
+    return busy.back().engine.get();
+}
+
+void EnginePool::release(Engine *engine)
+{
+    auto it = std::find_if(busy.begin(), busy.end(), [=](const Slot &s) {
+        return s.engine.get() == engine;
+    });
+    assert(it != busy.end());
+
+    idle.push_front(std::move(*it));
+    busy.erase(it);
+
+    while (idle.size() > capacity) {
+        drop(idle.back());
+        idle.pop_back();
+    }
+}
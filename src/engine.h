@@ -22,15 +22,67 @@
 #include <cinttypes>
 #include <cstdbool>
 #include <cstdio>
+#include <list>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "util.h"
 
 class Worker;
 
+// How engine processes are launched on POSIX systems. vfork (Linux only) lets the child
+// borrow the memory of the parent until it execs, instead of copying its page tables.
+enum SpawnMode { SPAWN_VFORK, SPAWN_FORK, NB_SPAWN_MODE };
+
+extern const char *SpawnModeName[NB_SPAWN_MODE];
+
+// How the maxmemory of engines is enforced, when asked to
+enum MemLimitMode {
+    MEMLIMIT_NONE,    // only sent to the engine with INFO max_memory
+    MEMLIMIT_CGROUP,  // memory.max of a cgroup v2 of its own, on Linux
+    MEMLIMIT_RLIMIT,  // RLIMIT_AS, with some room for code and thread stacks
+    NB_MEMLIMIT_MODE
+};
+
+extern const char *MemLimitModeName[NB_MEMLIMIT_MODE];
+
+// Picks the cgroup mode when engine cgroups can be created under cgroupDir (the cgroup of
+// the process if empty) with the memory controller, and RLIMIT_AS otherwise. Returns the
+// mode, used by all engines started afterwards.
+MemLimitMode memlimit_init(const std::string &cgroupDir);
+
+// Reaps the engines terminated by force, and removes their cgroup. With wait, the ones
+// still running are killed and waited for.
+void engine_reap_killed(bool wait);
+
+// CPU time and memory of an engine process, sampled from /proc/<pid>/stat while it runs,
+// or given by wait4() when it exits. Linux only, left at zero elsewhere.
+struct Usage
+{
+    int64_t userMsec, sysMsec;
+    int64_t rssKB;  // resident set size, or its peak when exited
+};
+
+// Resource usage of an engine summed over moves
+struct EngineUsage
+{
+    uint64_t moves;
+    int64_t  time, cpuMsec;  // wall and CPU (user + system) time
+    int64_t  peakRssKB;      // of the samples and of the exited processes
+    int64_t  exitCpuMsec;    // CPU time of the exited processes, startup included
+
+    void add_move(int64_t moveTime, const Usage &u);
+    void add(const EngineUsage &other);
+};
+
 // Elements remembered from parsing info lines (for writing PGN comments)
 struct Info
 {
     int     score, depth;
     int64_t time;
+    Usage   usage;  // CPU time used during the move, and RSS at its end
 };
 
 // Engine process
@@ -39,16 +91,23 @@ class Engine
 public:
     std::string name;
 
-    Engine(Worker *worker, bool debug, std::string *outmsg);
+    Engine(Worker *worker, bool debug, std::string *outmsg, SpawnMode spawnMode);
     Engine(const Engine &) = delete;  // disable copy
     ~Engine();
 
-    void start(const char *cmd, const char *name, int64_t tolerance);
+    // memLimit: bytes of memory enforced with the memlimit_init() mode, 0 for none
+    void
+    start(const char *cmd, const char *name, int64_t tolerance, int64_t memLimit = 0);
     void terminate(bool force = false);
 
-    bool readln(std::string &line);
+    bool readln(std::string_view &line);  // line is valid until the next readln()
     void writeln(const char *buf);
 
+    // Lines written between batch_begin() and batch_end() are sent together, with one
+    // write to the pipe
+    void batch_begin();
+    void batch_end();
+
     bool wait_for_ok(bool fatalError);
     bool bestmove(int64_t &    timeLeft,
                   int64_t      maxTurnTime,
@@ -57,11 +116,16 @@ public:
                   int          moveply);
 
     bool is_ok() const { return pid != 0; }
-    bool is_crashed() const { return pid && (!in || !out); }
+    bool is_crashed() const { return pid && (!in.is_open() || !out); }
+    bool is_out_of_memory() const;  // killed by the kernel for exceeding memLimit
+    bool is_running() const;        // the process has not exited, even if not reaped
+
+    EngineUsage exited = {};  // processes reaped by terminate()
 
 private:
-    Worker *const w;
-    const bool    isDebug;
+    Worker *const   w;
+    const bool      isDebug;
+    const SpawnMode spawnMode;
 
 #ifdef __MINGW32__
     long  pid;
@@ -70,13 +134,61 @@ private:
     pid_t pid;
 #endif
 
-    FILE *       in, *out;
+    LineReader   in;
+    FILE *       out;
+    std::string  outBuf;  // lines not written yet
+    bool         batching;
     std::string *messages;
     int64_t      tolerance;
+    int          statFd;  // /proc/<pid>/stat, -1 if not available
+    int64_t      memLimit;
+    std::string  cgroup;  // own cgroup of the process, empty if none
 
+    bool read_usage(Usage &u) const;
     void spawn(const char *cwd, const char *run, const char **argv, bool readStdErr);
+    void flush_lines();
     void parse_about(const char *fallbackName);
     // process MESSAGE, UNKNOWN, ERROR, DEBUG messages
     void process_message_ifneeded(const char *line);
     void parse_thinking_messages(const char *line, Info &info);
 };
+
+// Engines of a worker, kept running across pairing changes. A released engine stays
+// idle, and is handed back by the next acquire() of the same engine index instead of
+// being restarted. Idle engines beyond the capacity are terminated, least recently used
+// first, so a capacity of 0 terminates engines as soon as they are released.
+class EnginePool
+{
+public:
+    EnginePool(Worker *     worker,
+               bool         debug,
+               std::string *outmsg,
+               SpawnMode    spawnMode,
+               size_t       capacity);
+    ~EnginePool();
+
+    // Returns a running engine ei, started with cmd unless an idle one is available
+    Engine *acquire(int         ei,
+                    const char *cmd,
+                    const char *name,
+                    int64_t     tolerance,
+                    int64_t     memLimit);
+    void    release(Engine *engine);
+
+private:
+    struct Slot
+    {
+        std::unique_ptr<Engine> engine;
+        int                     ei;
+    };
+
+    void drop(Slot &slot);  // terminates the engine, and adds up its usage in the worker
+
+    Worker *const      w;
+    const bool         isDebug;
+    std::string *const messages;
+    const SpawnMode    spawnMode;
+    const size_t       capacity;
+    std::list<Slot>    idle;  // most recently released first
+    std::vector<Slot>  busy;
+};
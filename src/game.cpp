@@ -26,8 +26,17 @@
 #include <iostream>
 #include <string>
 
+// State of a game lost by an engine which failed to answer
+static int engine_failure_state(const Engine &engine)
+{
+    if (!engine.is_crashed())
+        return STATE_TIME_LOSS;
+    return engine.is_out_of_memory() ? STATE_OUT_OF_MEMORY : STATE_CRASHED;
+}
+
 Game::Game(int rd, int gm, Worker *worker)
-    : game_rule()
+    : usage()
+    , game_rule()
     , round(rd)
     , game(gm)
     , ply()
@@ -41,10 +50,10 @@ bool Game::load_opening(std::string_view opening_str,
                         size_t           currentRound,
                         Color &          color)
 {
-    pos.emplace_back(o.boardSize);
+    pos = Position(o.boardSize);
 
-    if (pos[0].apply_opening(opening_str, o.openingType)) {
-        color = pos[0].get_turn();
+    if (pos.apply_opening(opening_str, o.openingType)) {
+        color = pos.get_turn();
     }
     else {
         return false;
@@ -52,7 +61,7 @@ bool Game::load_opening(std::string_view opening_str,
 
     if (o.transform) {
         TransformType transType = (TransformType)(currentRound % NB_TRANS);
-        pos[0].transform(transType);
+        pos.transform(transType);
     }
 
     return true;
@@ -70,10 +79,23 @@ int Game::game_apply_rules(move_t lastmove)
             allow_long_connection = false;
     }
 
-    if (pos[ply].check_five_in_line_lastmove(allow_long_connection)) {
+    const bool fiveConnected = pos.check_five_in_line_lastmove(allow_long_connection);
+
+#ifndef NDEBUG
+    // Check mode (debug build): the last move path must agree with a full board scan.
+    // c-gomoku-bench runs the same check in release builds.
+    if (lastmove != NONE_MOVE) {
+        Position fullScan = pos;
+        assert(fiveConnected
+               == fullScan.check_five_in_line_side(ColorFromMove(lastmove),
+                                                   allow_long_connection));
+    }
+#endif
+
+    if (fiveConnected) {
         return STATE_FIVE_CONNECT;
     }
-    else if (pos[ply].get_moves_left() == 0) {
+    else if (pos.get_moves_left() == 0) {
         return STATE_DRAW_INSUFFICIENT_SPACE;
     }
 
@@ -92,6 +114,9 @@ void Game::gomocup_game_info_command(const EngineOptions &eo,
                                      const Options &      option,
                                      Engine &             engine)
 {
+    // the whole INFO block is sent at once
+    engine.batch_begin();
+
     // game info
     engine.writeln(format("INFO rule %i", option.gameRule).c_str());
 
@@ -122,6 +147,8 @@ void Game::gomocup_game_info_command(const EngineOptions &eo,
 
         engine.writeln(format("INFO %s %s", left, right).c_str());
     }
+
+    engine.batch_end();
 }
 
 void Game::send_board_command(const Position &position, Engine &engine)
@@ -138,9 +165,14 @@ void Game::send_board_command(const Position &position, Engine &engine)
     for (int i = 0; i < moveCnt; i++) {
         Color color           = ColorFromMove(histMoves[i]);
         int   gomocupColorIdx = colorToGomocupStoneIdx(color);
-        Pos   p               = PosFromMove(histMoves[i]);
 
-        engine.writeln(format("%i,%i,%i", CoordX(p), CoordY(p), gomocupColorIdx).c_str());
+        // "x,y,c"
+        char stoneCmd[16];
+        auto res = Position::move_to_gomostr(histMoves[i], stoneCmd, stoneCmd + 12);
+        res.ptr[0] = ',';
+        res.ptr[1] = char('0' + gomocupColorIdx);
+        res.ptr[2] = '\0';
+        engine.writeln(stoneCmd);
     }
 
     engine.writeln("DONE");
@@ -160,7 +192,7 @@ void Game::compute_time_left(const EngineOptions &eo, int64_t &timeLeft)
 }
 
 int Game::play(const Options &      o,
-               Engine               engines[2],
+               Engine *             engines[2],
                const EngineOptions *eo[2],
                bool                 reverse)
 // Play a game:
@@ -181,21 +213,21 @@ int Game::play(const Options &      o,
     this->board_size = o.boardSize;
 
     for (int color = BLACK; color <= WHITE; color++) {
-        names[color] = engines[color ^ pos[0].get_turn() ^ reverse].name;
+        names[color] = engines[color ^ pos.get_turn() ^ reverse]->name;
     }
 
     for (int i = 0; i < 2; ei = (1 - ei), i++) {
         // tell engine to start a new game
-        engines[i].writeln(format("START %i", o.boardSize).c_str());
+        engines[i]->writeln(format("START %i", o.boardSize).c_str());
 
         // wait for engine to answer OK
-        if (!engines[i].wait_for_ok(o.fatalError)) {
-            state = engines[i].is_crashed() ? STATE_CRASHED : STATE_TIME_LOSS;
+        if (!engines[i]->wait_for_ok(o.fatalError)) {
+            state = engine_failure_state(*engines[i]);
             return ei == 0 ? RESULT_LOSS : RESULT_WIN;
         }
 
         // send game info
-        gomocup_game_info_command(*eo[i], o, engines[i]);
+        gomocup_game_info_command(*eo[i], o, *engines[i]);
     }
 
     // init time control
@@ -206,11 +238,11 @@ int Game::play(const Options &      o,
 
     for (ply = 0;; ei = (1 - ei), ply++) {
         if (played != NONE_MOVE) {
-            pos[ply].move_with_copy(pos[ply - 1], played);
+            pos.move(played);
         }
 
         if (o.debug) {
-            pos[ply].print();
+            pos.print();
         }
 
         state = game_apply_rules(played);
@@ -219,7 +251,7 @@ int Game::play(const Options &      o,
         }
 
         // Apply force draw adjudication rule
-        if (o.forceDrawAfter && pos[ply].get_move_count() >= o.forceDrawAfter) {
+        if (o.forceDrawAfter && pos.get_move_count() >= o.forceDrawAfter) {
             state = STATE_DRAW_ADJUDICATION;
             break;
         }
@@ -227,42 +259,49 @@ int Game::play(const Options &      o,
         // Prepare timeLeft[ei]
         compute_time_left(*eo[ei], timeLeft[ei]);
 
-        // output game/turn info
-        gomocup_turn_info_command(*eo[ei], timeLeft[ei], engines[ei]);
+        // output game/turn info, sent with the think command in a single write
+        engines[ei]->batch_begin();
+        gomocup_turn_info_command(*eo[ei], timeLeft[ei], *engines[ei]);
 
         // trigger think!
-        if (pos[ply].get_move_count() == 0) {
-            engines[ei].writeln("BEGIN");
+        if (pos.get_move_count() == 0) {
+            engines[ei]->writeln("BEGIN");
             canUseTurn[ei] = true;
         }
         else {
             if (o.useTURN && canUseTurn[ei]) {  // use TURN to trigger think
-                engines[ei].writeln(
-                    format("TURN %s", pos[ply].move_to_gomostr(played)).c_str());
+                char turnCmd[32] = "TURN ";
+                auto res = Position::move_to_gomostr(played, turnCmd + 5, turnCmd + 31);
+                *res.ptr = '\0';
+                engines[ei]->writeln(turnCmd);
             }
             else {  // use BOARD to trigger think
-                send_board_command(pos[ply], engines[ei]);
+                send_board_command(pos, *engines[ei]);
                 canUseTurn[ei] = true;
             }
         }
+        engines[ei]->batch_end();
 
         std::string bestmove;
         Info        moveInfo = {};
-        const bool  ok       = engines[ei].bestmove(timeLeft[ei],
+        const bool  ok       = engines[ei]->bestmove(timeLeft[ei],
                                              eo[ei]->timeoutTurn,
                                              bestmove,
                                              moveInfo,
-                                             pos[ply].get_move_count() + 1);
+                                             pos.get_move_count() + 1);
         this->info.push_back(moveInfo);
+        usage[pos.get_turn()].add_move(moveInfo.time, moveInfo.usage);
 
         if (!ok) {  // engine crashed/hard timeout in bestmove()
+            state = engine_failure_state(*engines[ei]);
             DIE_OR_ERR(o.fatalError,
                        "[%d] engine %s %s at %d moves after opening\n",
                        w->id,
-                       engines[ei].name.c_str(),
-                       engines[ei].is_crashed() ? "crashed" : "timeout",
+                       engines[ei]->name.c_str(),
+                       state == STATE_OUT_OF_MEMORY ? "out of memory"
+                       : state == STATE_CRASHED     ? "crashed"
+                                                    : "timeout",
                        ply);
-            state = engines[ei].is_crashed() ? STATE_CRASHED : STATE_TIME_LOSS;
             break;
         }
 
@@ -270,19 +309,18 @@ int Game::play(const Options &      o,
             && timeLeft[ei] < 0) {  // engine soft timeout in bestmove()
             printf("[%d] engine %s timeout at %d moves after opening\n",
                    w->id,
-                   engines[ei].name.c_str(),
+                   engines[ei]->name.c_str(),
                    ply);
             state = STATE_TIME_LOSS;
             break;
         }
 
-        played = pos[ply].gomostr_to_move(bestmove);
-
-        // Check if move is legal
-        if (!pos[ply].is_legal_move(played)) {
+        // Check if move is legal, out of board moves included
+        if (pos.gomostr_to_move(bestmove, played) != MOVESTR_OK
+            || !pos.is_legal_move(played)) {
             printf("[%d] engine %s output illegal move at %d moves after opening: %s\n",
                    w->id,
-                   engines[ei].name.c_str(),
+                   engines[ei]->name.c_str(),
                    ply,
                    bestmove.c_str());
             state = STATE_ILLEGAL_MOVE;
@@ -291,7 +329,7 @@ int Game::play(const Options &      o,
 
         // Check forbidden move for Renju rule
         if (game_rule == RENJU
-            && (forbidden_type = pos[ply].check_forbidden_move(played))) {
+            && (forbidden_type = pos.check_forbidden_move(played))) {
             state = STATE_FORBIDDEN_MOVE;
             break;
         }
@@ -321,22 +359,20 @@ int Game::play(const Options &      o,
         // Write sample: position (compactly encoded) + move
         if (!o.sp.fileName.empty() && prngf(w->seed) <= o.sp.freq) {
             Sample sample = {
-                .pos    = pos[ply],
-                .move   = played,
-                .result = NB_RESULT  // mark as invalid for now, computed after the game
+                .moveCount = pos.get_move_count(),
+                .move      = played,
+                .result    = NB_RESULT  // mark as invalid, computed after the game
             };
 
             // Record sample.
             samples.push_back(sample);
         }
-
-        pos.emplace_back();
     }
 
     assert(state != STATE_NONE);
 
     // Fill results in samples
-    if (state == STATE_TIME_LOSS || state == STATE_CRASHED
+    if (state == STATE_TIME_LOSS || state == STATE_CRASHED || state == STATE_OUT_OF_MEMORY
         || state == STATE_ILLEGAL_MOVE) {
         samples.clear();  // discard samples in a time loss/crash/illegal move game
     }
@@ -344,12 +380,15 @@ int Game::play(const Options &      o,
         // Signed result from white's pov: 0 (loss), 1 (draw), 2 (win)
         const int wpov =
             state < STATE_SEPARATOR
-                ? (pos[ply].get_turn() == WHITE ? RESULT_LOSS
-                                                : RESULT_WIN)  // lost from turn's pov
+                ? (pos.get_turn() == WHITE ? RESULT_LOSS
+                                           : RESULT_WIN)  // lost from turn's pov
                 : RESULT_DRAW;
 
-        for (size_t i = 0; i < samples.size(); i++)
-            samples[i].result = samples[i].pos.get_turn() == WHITE ? wpov : 2 - wpov;
+        // Side to move of a sample is the color of the move played from it
+        for (size_t i = 0; i < samples.size(); i++) {
+            Color sideToMove  = ColorFromMove(samples[i].move);
+            samples[i].result = sideToMove == WHITE ? wpov : 2 - wpov;
+        }
     }
 
     return state < STATE_SEPARATOR
@@ -368,7 +407,7 @@ void Game::decode_state(std::string &result,
     // and next side to move is <color>, then the side of win is opponent(<color>),
     // which is last moved side
 
-    bool isBlackTurn = pos[ply].get_turn() == BLACK;
+    bool isBlackTurn = pos.get_turn() == BLACK;
 
     if (state == STATE_NONE) {
         result = "*";
@@ -414,6 +453,11 @@ void Game::decode_state(std::string &result,
         reason =
             isBlackTurn ? "White win by opponent crash" : "Black win by opponent crash";
     }
+    else if (state == STATE_OUT_OF_MEMORY) {
+        result = isBlackTurn ? restxt[RESULT_LOSS] : restxt[RESULT_WIN];
+        reason = isBlackTurn ? "White win by opponent out of memory"
+                             : "Black win by opponent out of memory";
+    }
     else
         assert(false);
 }
@@ -494,7 +538,7 @@ std::string Game::export_sgf(size_t gameIdx) const
     out.push_back('\n');
 
     // Print the moves
-    const Position &lastPos = pos[ply];
+    const Position &lastPos = pos;
 
     // openning moves
     int openingMoveCnt = lastPos.get_move_count() - ply;
@@ -534,8 +578,15 @@ std::string Game::export_sgf(size_t gameIdx) const
             // const int dep = this->info[thinkPly].depth;
             // const int scr = this->info[thinkPly].score;
             const int64_t tim = this->info[thinkPly].time;
+            const Usage & use = this->info[thinkPly].usage;
             // str_cat_fmt(out, "C[%i/%i %Ims]", scr, dep, tim);
-            out += format("C[%" PRId64 "ms]", tim);
+            if (use.rssKB)
+                out += format("C[%" PRId64 "ms, cpu %" PRId64 "ms, rss %" PRId64 "KB]",
+                              tim,
+                              use.userMsec + use.sysMsec,
+                              use.rssKB);
+            else
+                out += format("C[%" PRId64 "ms]", tim);
 
             moveCnt++;
         }
@@ -546,17 +597,52 @@ std::string Game::export_sgf(size_t gameIdx) const
     return out;
 }
 
-void Game::export_samples_csv(FILE *out) const
+// One CSV line per move played by an engine: game index, move number, engine name, wall
+// time, user and system CPU time in ms, then RSS in KB at the end of the move
+std::string Game::export_stats(size_t gameIdx) const
 {
+    std::string   out;
+    const int     openingMoveCnt = pos.get_move_count() - ply;
+    const move_t *histMove       = pos.get_hist_moves();
+
+    for (int i = 0; i < (int)info.size(); i++) {
+        const int   j = openingMoveCnt + i;
+        // the last move is missing from the history when the engine failed to play it
+        const Color color = j < pos.get_move_count() ? ColorFromMove(histMove[j])
+                                                     : pos.get_turn();
+        const Info &in    = info[i];
+
+        out += format("%zu,%d,%s,%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 "\n",
+                      gameIdx,
+                      j + 1,
+                      names[color],
+                      in.time,
+                      in.usage.userMsec,
+                      in.usage.sysMsec,
+                      in.usage.rssKB);
+    }
+
+    return out;
+}
+
+void Game::export_samples_csv(std::string &out) const
+{
+    // Samples are in game order, so rebuild their positions with a single replay
+    Position      samplePos(board_size);
+    const move_t *histMoves = pos.get_hist_moves();
+
     for (size_t i = 0; i < samples.size(); i++) {
-        std::string pos_str = samples[i].pos.to_opening_str(OPENING_POS);
+        while (samplePos.get_move_count() < samples[i].moveCount)
+            samplePos.move(histMoves[samplePos.get_move_count()]);
+
+        std::string pos_str = samplePos.to_opening_str(OPENING_POS);
         std::string move_str =
-            samples[i].pos.move_to_opening_str(samples[i].move, OPENING_POS);
-        fprintf(out, "%s,%s,%d\n", pos_str.c_str(), move_str.c_str(), samples[i].result);
+            samplePos.move_to_opening_str(samples[i].move, OPENING_POS);
+        out += format("%s,%s,%d\n", pos_str.c_str(), move_str.c_str(), samples[i].result);
     }
 }
 
-void Game::export_samples_bin(FILE *out, LZ4F_compressionContext_t lz4Ctx) const
+void Game::export_samples_bin(std::string &out) const
 {
     struct Entry
     {
@@ -568,46 +654,42 @@ void Game::export_samples_bin(FILE *out, LZ4F_compressionContext_t lz4Ctx) const
             uint16_t rule : 3;       // game rule: 0=freestyle, 1=standard, 4=renju
             uint16_t move : 13;      // move output by the engine
         } head;
-        uint16_t position[1024];  // move sequence that representing a position
+        uint16_t position[Position::MaxMoves];  // move sequence representing a position
 
         static_assert(sizeof(EntryHead) == 4);
     } e;
-    const size_t bufSize = LZ4F_compressBound(sizeof(Entry), nullptr);
-    char         buf[bufSize];
+
+    // Sample positions are prefixes of the game history
+    const move_t *hist_moves = pos.get_hist_moves();
 
     for (size_t i = 0; i < samples.size(); i++) {
-        int           moveply    = samples[i].pos.get_move_count();
-        const move_t *hist_moves = samples[i].pos.get_hist_moves();
-        assert(moveply < 1024);
+        int moveply = samples[i].moveCount;
+        assert(moveply <= Position::MaxMoves);
 
-        e.head.boardsize = samples[i].pos.get_size();
+        e.head.boardsize = pos.get_size();
         e.head.rule      = game_rule;
         e.head.ply       = moveply;
         e.head.result    = samples[i].result;
         e.head.move      = POS_RAW(CoordX(samples[i].move), CoordY(samples[i].move));
         for (int iMove = 0; iMove < moveply; iMove++) {
-            Pos pos           = PosFromMove(hist_moves[iMove]);
-            e.position[iMove] = POS_RAW(CoordX(pos), CoordY(pos));
+            Pos p             = PosFromMove(hist_moves[iMove]);
+            e.position[iMove] = POS_RAW(CoordX(p), CoordY(p));
         }
 
         const size_t entrySize = sizeof(Entry::EntryHead) + sizeof(uint16_t) * moveply;
-        if (lz4Ctx) {
-            size_t size =
-                LZ4F_compressUpdate(lz4Ctx, buf, bufSize, &e, entrySize, nullptr);
-            fwrite(buf, size, 1, out);
-        }
-        else {
-            fwrite(&e, entrySize, 1, out);
-        }
+        out.append((const char *)&e, entrySize);
     }
 }
 
-void Game::export_samples(FILE *out, bool bin, LZ4F_compressionContext_t lz4Ctx) const
+// Samples are returned uncompressed, whoever writes them compresses them as needed
+std::string Game::export_samples(bool bin) const
 {
-    FileLock fl(out);
+    std::string out;
 
     if (bin)
-        export_samples_bin(out, lz4Ctx);
+        export_samples_bin(out);
     else
         export_samples_csv(out);
+
+    return out;
 }
\ No newline at end of file
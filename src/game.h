@@ -16,7 +16,6 @@
 
 #pragma once
 #include "engine.h"
-#include "extern/lz4frame.h"
 #include "options.h"
 #include "position.h"
 
@@ -31,6 +30,7 @@ enum {
     STATE_FIVE_CONNECT,    // lost by being checkmated
     STATE_TIME_LOSS,       // lost on time
     STATE_CRASHED,         // lost by crashing in the middle of a game
+    STATE_OUT_OF_MEMORY,   // lost by being killed for exceeding the memory limit
     STATE_ILLEGAL_MOVE,    // lost by playing an illegal move
     STATE_FORBIDDEN_MOVE,  // lost by playing on a forbidden position
     STATE_RESIGN,          // resigned on behalf of the engine
@@ -42,24 +42,26 @@ enum {
     STATE_DRAW_ADJUDICATION         // draw by adjudication
 };
 
+// Sample position is not stored, but rebuilt from the game history on export
 struct Sample
 {
-    Position pos;
-    move_t   move;    // move returned by the engine
-    int      result;  // game result from pos.turn's pov
+    int    moveCount;  // number of stones on board before the move
+    move_t move;       // move returned by the engine
+    int    result;     // game result from side to move's pov
 };
 
 class Game
 {
 public:
-    std::string           names[NB_COLOR];  // names of players, by color
-    std::vector<Position> pos;   // list of positions (including moves) since game start
-    std::vector<Info>     info;  // remembered from parsing info lines (for PGN comments)
-    std::vector<Sample>   samples;    // list of samples when generating training data
-    GameRule              game_rule;  // rule is gomoku or renju, etc
-    ForbiddenType         forbidden_type;  // forbidden type of the last move (in renju)
-    int                   round, game, ply, state, board_size;
-    Worker *const         w;
+    std::string         names[NB_COLOR];  // names of players, by color
+    Position            pos;        // current position, its history holds all game moves
+    std::vector<Info>   info;       // remembered from parsing info lines (for comments)
+    EngineUsage         usage[NB_COLOR];  // summed over the moves of each player
+    std::vector<Sample> samples;    // list of samples when generating training data
+    GameRule            game_rule;  // rule is gomoku or renju, etc
+    ForbiddenType       forbidden_type;  // forbidden type of the last move (in renju)
+    int                 round, game, ply, state, board_size;
+    Worker *const       w;
 
     Game(int round, int game, Worker *worker);
 
@@ -68,14 +70,14 @@ public:
                       size_t           currentRound,
                       Color &          color);
     int
-    play(const Options &o, Engine engines[2], const EngineOptions *eo[2], bool reverse);
+    play(const Options &o, Engine *engines[2], const EngineOptions *eo[2], bool reverse);
 
     void
     decode_state(std::string &result, std::string &reason, const char *restxt[3]) const;
     std::string export_pgn(size_t gameIdx, int verbosity) const;
     std::string export_sgf(size_t gameIdx) const;
-    void
-    export_samples(FILE *out, bool bin, LZ4F_compressionContext_t lz4Ctx = nullptr) const;
+    std::string export_stats(size_t gameIdx) const;
+    std::string export_samples(bool bin) const;
 
 private:
     int  game_apply_rules(move_t lastmove);
@@ -87,6 +89,6 @@ private:
     void gomocup_game_info_command(const EngineOptions &eo,
                                    const Options &      option,
                                    Engine &             engine);
-    void export_samples_csv(FILE *out) const;
-    void export_samples_bin(FILE *out, LZ4F_compressionContext_t lz4Ctx) const;
+    void export_samples_csv(std::string &out) const;
+    void export_samples_bin(std::string &out) const;
 };
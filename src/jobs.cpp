@@ -19,154 +19,296 @@
 #include "util.h"
 #include "workers.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 
-static void job_queue_init_pair(int               games,
-                                int               e1,
-                                int               e2,
-                                int               pair,
-                                int &             added,
-                                int               round,
-                                std::vector<Job> &jobs)
-{
-    for (int g = 0; g < games; g++) {
-        const Job j = {.ei      = {e1, e2},
-                       .pair    = pair,
-                       .round   = round,
-                       .game    = added++,
-                       .reverse = (bool)(g % 2)};
-        jobs.push_back(j);
-    }
-}
+const char *ScheduleModeName[NB_SCHEDULE_MODE] = {"index", "pair"};
 
-JobQueue::JobQueue(int engines, int rounds, int games, bool gauntlet)
-    : idx(0)
+JobQueue::JobQueue(int          engines,
+                   int          rounds,
+                   int          games,
+                   bool         gauntlet,
+                   int          workers,
+                   ScheduleMode scheduleMode)
+    : results(gauntlet ? engines - 1 : engines * (engines - 1) / 2)
+    , idx(0)
     , completed(0)
+    , switches(workers)
+    , gamesPerPair(games)
+    , jobsPerRound((size_t)games * results.size())
+    , jobCount(jobsPerRound * rounds)
+    , schedule(scheduleMode)
+    , windowRounds(std::max<size_t>(1, (workers + results.size() - 1) / results.size()))
+    , skipped(0)
+    , jobsLeft(jobCount)
+    , scan(0)
+    , pairs(results.size())
+    , lastPair(workers, -1)
+    , nameOnce(engines)
+    , named(engines)
 {
     assert(engines >= 2 && rounds >= 1 && games >= 1);
 
+    if ((uint64_t)rounds * games > Result::CountMax)
+        DIE("at most %" PRIu64 " games per pair\n", Result::CountMax);
+
     // Prepare engine names: blank for now, will be discovered at run time (concurrently)
     names.resize(engines);
 
     if (gauntlet) {
         // Gauntlet: N-1 pairs (0, e2) with 0 < e2
         for (int e2 = 1; e2 < engines; e2++) {
-            const Result r = {.ei = {0, e2}, .count = {0}};
-            results.push_back(r);
-        }
-
-        for (int r = 0; r < rounds; r++) {
-            int added = 0;  // number of games already added to the current round
-
-            for (int e2 = 1; e2 < engines; e2++)
-                job_queue_init_pair(games, 0, e2, e2 - 1, added, r, jobs);
+            results[e2 - 1].ei[0] = 0;
+            results[e2 - 1].ei[1] = e2;
         }
     }
     else {
         // Round robin: N(N-1)/2 pairs (e1, e2) with e1 < e2
+        int p = 0;
         for (int e1 = 0; e1 < engines - 1; e1++)
-            for (int e2 = e1 + 1; e2 < engines; e2++) {
-                const Result r = {.ei = {e1, e2}, .count = {0}};
-                results.push_back(r);
+            for (int e2 = e1 + 1; e2 < engines; e2++, p++) {
+                results[p].ei[0] = e1;
+                results[p].ei[1] = e2;
             }
+    }
+
+    startedTime = system_msec();
+}
+
+// Each round plays the pairs in order, each pair playing its games in a row, with colors
+// alternating from one game to the next
+Job JobQueue::job_at(size_t i) const
+{
+    assert(i < jobCount);
+
+    const size_t inRound = i % jobsPerRound;
+    const int    pair    = int(inRound / gamesPerPair);
+    const Job    j       = {.ei      = {results[pair].ei[0], results[pair].ei[1]},
+                            .pair    = pair,
+                            .round   = int(i / jobsPerRound),
+                            .game    = int(inRound),
+                            .reverse = (bool)(inRound % gamesPerPair % 2)};
+    return j;
+}
 
-        for (int r = 0; r < rounds; r++) {
-            int pair  = 0;  // enumerate pairs in order
-            int added = 0;  // number of games already added to the current round
+// Index of the n-th job of a pair, rounds after rounds
+size_t JobQueue::pair_job(int pair, size_t n) const
+{
+    return n / gamesPerPair * jobsPerRound + (size_t)pair * gamesPerPair
+           + n % gamesPerPair;
+}
 
-            for (int e1 = 0; e1 < engines - 1; e1++)
-                for (int e2 = e1 + 1; e2 < engines; e2++)
-                    job_queue_init_pair(games, e1, e2, pair++, added, r, jobs);
+// Pairs only run windowRounds rounds ahead of the lowest round with a job left to claim,
+// so that the games completed ahead of the output order, which SeqWriter holds back, stay
+// within about a round (workers x games with more workers than pairs) instead of growing
+// with the run. Returns the first job of a pair, counted as in pair_job(), out of it.
+size_t JobQueue::pair_window_end() const
+{
+    const size_t pairJobs = jobCount / pairs.size();
+
+    size_t lowest = pairJobs;
+    for (const PairQueue &pair : pairs)
+        lowest = std::min(lowest, pair.next.load(std::memory_order_relaxed));
+
+    return std::min(pairJobs, (lowest / gamesPerPair + windowRounds) * gamesPerPair);
+}
+
+// Next job of the pair the worker is playing, or else the first job of the pair changing
+// the fewest engines, the least crowded one among those, so that workers spread out over
+// the pairs. Ties go to the lowest pair, which roughly keeps the game index order. Only
+// the pairs whose next job is in the window are looked at.
+// The caller has claimed one of the jobs left, so a job is found, though a pair may run
+// out or leave the window between the scan and the claim, and then the scan is done
+// again. The pair with the lowest job left is always in the window.
+size_t JobQueue::pick_pair_job(int workerId)
+{
+    const int last = lastPair[workerId - 1];
+
+    if (last >= 0)
+        while (pairs[last].next.load(std::memory_order_relaxed) < pair_window_end()) {
+            const size_t next = pairs[last].next.fetch_add(1, std::memory_order_relaxed);
+            if (next >= jobCount / pairs.size())
+                break;
+            if (const size_t i = pair_job(last, next); !is_skipped(i))
+                return i;
+        }
+
+    for (;;) {
+        const size_t end  = pair_window_end();
+        int          best = -1, bestCost = 0;
+        for (size_t p = 0; p < pairs.size(); p++) {
+            if (pairs[p].next.load(std::memory_order_relaxed) >= end)
+                continue;
+
+            // engine changes weigh more than any number of workers
+            const int *ei      = results[p].ei;
+            const int  changes = last < 0 ? 2
+                                          : (ei[0] != results[last].ei[0])
+                                                + (ei[1] != results[last].ei[1]);
+            const int  cost    = changes * (int)lastPair.size()
+                             + pairs[p].workers.load(std::memory_order_relaxed);
+
+            if (best < 0 || cost < bestCost) {
+                best     = (int)p;
+                bestCost = cost;
+            }
+        }
+
+        if (best < 0)
+            continue;  // the window moved meanwhile
+
+        // skipped jobs are passed over at once, within the window
+        for (size_t next = 0; next < end;) {
+            next = pairs[best].next.fetch_add(1, std::memory_order_relaxed);
+            if (next >= jobCount / pairs.size())
+                break;
+            if (const size_t i = pair_job(best, next); !is_skipped(i))
+                return i;
         }
     }
+}
 
-    startedTime = system_msec();
+// Next job in index order, skipping the ones not to play. The caller has claimed one of
+// the jobs left, so there is one.
+size_t JobQueue::pick_index_job()
+{
+    size_t i;
+    do
+        i = scan.fetch_add(1, std::memory_order_relaxed);
+    while (skip[i]);
+    return i;
 }
 
-bool JobQueue::pop(Job &j, size_t &idx_in, size_t &count)
+bool JobQueue::pop(int workerId, Job &j, size_t &idx_in, size_t &count)
 {
-    std::lock_guard lock(mtx);
+    // Claim one of the jobs left. Claims beyond the last job, or after stop(), fail.
+    const size_t claimed = idx.fetch_add(1, std::memory_order_relaxed);
+    if (claimed >= jobsLeft)
+        return false;
+
+    idx_in = schedule == SCHEDULE_PAIR ? pick_pair_job(workerId)
+             : !skip.empty()           ? pick_index_job()
+                                       : claimed;
+    j      = job_at(idx_in);
+    count  = jobCount;
 
-    if (idx < jobs.size()) {
-        j      = jobs[idx];
-        idx_in = idx++;
-        count  = jobs.size();
-        return true;
+    // Engine switch bookkeeping, of the worker's own entries
+    int &last = lastPair[workerId - 1];
+    if (last >= 0) {
+        switches[workerId - 1] +=
+            (j.ei[0] != results[last].ei[0]) + (j.ei[1] != results[last].ei[1]);
+        pairs[last].workers.fetch_sub(1, std::memory_order_relaxed);
     }
+    last = j.pair;
+    pairs[last].workers.fetch_add(1, std::memory_order_relaxed);
 
-    return false;
+    return true;
 }
 
 // Add game outcome, and return updated totals
-void JobQueue::add_result(int pair, int outcome, int count[3])
+size_t JobQueue::add_result(int pair, int outcome, int count[3])
 {
-    std::lock_guard lock(mtx);
-
-    results[pair].count[outcome]++;
-    completed++;
+    const uint64_t one    = 1ULL << (outcome * Result::CountBits);
+    const uint64_t packed = results[pair].packed.fetch_add(one) + one;
+    Result::unpack(packed, count);
 
-    for (size_t i = 0; i < 3; i++)
-        count[i] = results[pair].count[i];
+    return completed.fetch_add(1) + 1;
 }
 
 bool JobQueue::done()
 {
-    std::lock_guard lock(mtx);
-
-    assert(idx <= jobs.size());
-    return idx == jobs.size();
+    return idx.load() >= jobsLeft;
 }
 
 void JobQueue::stop()
 {
-    std::lock_guard lock(mtx);
-    idx = jobs.size();
+    idx.store(jobCount);
 }
 
-void JobQueue::set_name(int ei, std::string_view name)
+void JobQueue::skip_jobs(size_t first, size_t last)
 {
-    std::lock_guard lock(mtx);
+    skip.resize(jobCount);
+    for (size_t i = first; i < last; i++)
+        if (!skip[i]) {
+            skip[i] = 1;
+            skipped++;
+        }
+    jobsLeft = jobCount - skipped;
+}
+
+// Shards are contiguous slices of the game indices, so that their output files, put end
+// to end, are those of a single run
+void JobQueue::set_shard(int k, int n)
+{
+    assert(1 <= k && k <= n);
+    skip_jobs(0, shard_first(k, n));
+    skip_jobs(shard_first(k + 1, n), jobCount);
+}
+
+void JobQueue::resume(const std::vector<uint8_t> &finished)
+{
+    assert(finished.size() == jobCount);
 
-    if (names[ei].empty())
+    for (size_t i = 0; i < jobCount; i++)
+        if (finished[i])
+            skip_jobs(i, i + 1);
+    completed.store(std::count(finished.begin(), finished.end(), 1));
+}
+
+// Engines are named by the first worker starting them. The name is published by named[],
+// so that print_results() never reads a name being written.
+void JobQueue::set_name(int ei, std::string_view name)
+{
+    std::call_once(nameOnce[ei], [&] {
         names[ei] = name;
+        named[ei].store(true, std::memory_order_release);
+    });
 }
 
-void JobQueue::print_results(size_t frequency)
+std::string JobQueue::get_name(int ei) const
 {
-    std::lock_guard lock(mtx);
+    return named[ei].load(std::memory_order_acquire) ? names[ei] : std::string();
+}
 
-    if (completed && completed % frequency == 0) {
+void JobQueue::print_results(size_t completedCount, size_t frequency)
+{
+    if (completedCount % frequency == 0) {
         std::string out = "Tournament update:\n";
 
-        // Print out tournament results up to now
+        // Print out tournament results up to now, each pair from a single load
         for (size_t i = 0; i < results.size(); i++) {
-            const Result r = results[i];
-            const int    n =
-                r.count[RESULT_WIN] + r.count[RESULT_LOSS] + r.count[RESULT_DRAW];
+            const Result &r = results[i];
+            int           count[3];
+            Result::unpack(r.packed.load(), count);
+            const int n = count[RESULT_WIN] + count[RESULT_LOSS] + count[RESULT_DRAW];
 
             if (n) {
                 char score[8] = "";
                 sprintf(score,
                         "%.3f",
-                        (r.count[RESULT_WIN] + 0.5 * r.count[RESULT_DRAW]) / n);
+                        (count[RESULT_WIN] + 0.5 * count[RESULT_DRAW]) / n);
                 out += format("%s vs %s: %i - %i - %i  [%s] %i\n",
-                              names[r.ei[0]],
-                              names[r.ei[1]],
-                              r.count[RESULT_WIN],
-                              r.count[RESULT_LOSS],
-                              r.count[RESULT_DRAW],
+                              named[r.ei[0]].load(std::memory_order_acquire)
+                                  ? names[r.ei[0]].c_str()
+                                  : "",
+                              named[r.ei[1]].load(std::memory_order_acquire)
+                                  ? names[r.ei[1]].c_str()
+                                  : "",
+                              count[RESULT_WIN],
+                              count[RESULT_LOSS],
+                              count[RESULT_DRAW],
                               score,
                               n);
             }
         }
 
         // Print out average match speed and estimated time to complete (ETA)
-        if (idx < jobs.size()) {
-            assert(idx > 0);
+        if (const size_t claimed = idx.load(); claimed < jobsLeft) {
+            assert(claimed > 0);
             int64_t elapsed = system_msec() - startedTime;
-            double  speed   = idx / std::max<double>(elapsed, 1.0);  // avoid divide by 0
-            int64_t eta     = int64_t((jobs.size() - idx) / speed);
+            double  speed   = claimed / std::max<double>(elapsed, 1.0);  // avoid div by 0
+            int64_t eta     = int64_t((jobsLeft - claimed) / speed);
             int64_t etaHour = eta / 3600000;
             int64_t etaMinate = (eta % 3600000) / 60000;
             int64_t etaSecond = ((eta % 3600000) % 60000) / 1000;
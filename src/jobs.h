@@ -16,19 +16,49 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <mutex>
 #include <string>
 #include <string_view>
 #include <vector>
 
 // Result for each pair (e1, e2); e1 < e2. Stores count of game outcomes from e1's point
-// of view.
+// of view, packed in a single atomic word, so that they are updated and read together
+// without a lock.
 struct Result
 {
-    int ei[2];
-    int count[3];
+    static const int      CountBits = 21;
+    static const uint64_t CountMax  = (1ULL << CountBits) - 1;
+
+    int                   ei[2];
+    std::atomic<uint64_t> packed{0};
+
+    static void unpack(uint64_t packed, int count[3])
+    {
+        for (int i = 0; i < 3; i++)
+            count[i] = int((packed >> (i * CountBits)) & CountMax);
+    }
+
+    static uint64_t pack(const int count[3])
+    {
+        uint64_t packed = 0;
+        for (int i = 0; i < 3; i++)
+            packed |= uint64_t(count[i]) << (i * CountBits);
+        return packed;
+    }
 };
 
+// Order in which the jobs are handed out to workers. Game indices, hence output files,
+// are the same in both modes.
+enum ScheduleMode {
+    SCHEDULE_INDEX,  // in game index order
+    SCHEDULE_PAIR,   // each worker keeps playing the same pair while it can
+    NB_SCHEDULE_MODE
+};
+
+extern const char *ScheduleModeName[NB_SCHEDULE_MODE];
+
 // Job: instruction to play a single game
 struct Job
 {
@@ -37,26 +67,74 @@ struct Job
     bool reverse;      // if true, e1 plays second
 };
 
-// Job Queue: consumed by workers to play tournament (thread safe)
+// Job Queue: consumed by workers to play tournament (thread safe, and lock free: jobs are
+// claimed and results counted with atomic operations)
 class JobQueue
 {
 public:
-    JobQueue(int engines, int rounds, int games, bool gauntlet);
+    JobQueue(int          engines,
+             int          rounds,
+             int          games,
+             bool         gauntlet,
+             int          workers,
+             ScheduleMode schedule);
 
-    bool pop(Job &j, size_t &idx, size_t &count);
-    void add_result(int pair, int outcome, int count[3]);
-    bool done();
-    void stop();
+    bool pop(int workerId, Job &j, size_t &idx, size_t &count);
+    // returns the number of games completed, this one included
+    size_t add_result(int pair, int outcome, int count[3]);
+    bool   done();
+    void   stop();
+    // Must be called before the workers start: plays only the jobs of shard k (from 1 to
+    // n), and skips the games already played before resuming (finished[] by game index)
+    void   set_shard(int k, int n);
+    void   resume(const std::vector<uint8_t> &finished);
+    size_t job_count() const { return jobCount; }
+    Job    job_at(size_t idx) const;  // jobs are computed from their index, not stored
+    size_t shard_first(int k, int n) const { return jobCount * (k - 1) / n; }
 
-    void set_name(int ei, std::string_view name);
-    void print_results(size_t frequency);
+    void        set_name(int ei, std::string_view name);
+    std::string get_name(int ei) const;  // empty until set
+    // prints when the completed count (returned by add_result()) is a multiple of
+    // frequency
+    void print_results(size_t completedCount, size_t frequency);
 
 public:
-    std::mutex               mtx;
-    std::vector<Job>         jobs;
     std::vector<Result>      results;
-    std::vector<std::string> names;
-    size_t                   idx;        // next job index
-    size_t                   completed;  // number of jobs completed
+    std::vector<std::string> names;  // written once, see set_name()
+    std::atomic<size_t>      idx;    // number of jobs claimed (may overshoot jobsLeft)
+    std::atomic<size_t>      completed;  // number of jobs completed
     int64_t                  startedTime;
+
+    // Engine switches of each worker (indexed by worker id - 1): number of sides whose
+    // engine differs from the previous job of the worker
+    std::vector<uint64_t> switches;
+
+private:
+    size_t pair_job(int pair, size_t n) const;
+    size_t pair_window_end() const;
+    size_t pick_pair_job(int workerId);
+    size_t pick_index_job();
+    bool   is_skipped(size_t i) const { return !skip.empty() && skip[i]; }
+    void   skip_jobs(size_t first, size_t last);
+
+    const size_t       gamesPerPair, jobsPerRound, jobCount;
+    const ScheduleMode schedule;
+    const size_t       windowRounds;  // pair schedule lookahead, in rounds
+
+    // Jobs not to play, by index: other shards, and games played before resuming. All
+    // jobs but those are claimed.
+    std::vector<uint8_t> skip;
+    size_t               skipped, jobsLeft;
+    std::atomic<size_t>  scan;  // next job index to claim in index order, when skipping
+
+    struct PairQueue
+    {
+        std::atomic<size_t> next{0};     // next job of the pair to claim (may overshoot)
+        std::atomic<int>    workers{0};  // workers whose last job is of the pair
+    };
+    std::vector<PairQueue> pairs;
+    std::vector<int>       lastPair;  // per worker, -1 before its first job
+
+    std::vector<std::once_flag>    nameOnce;  // by engine index
+    std::vector<std::atomic<bool>> named;
 };
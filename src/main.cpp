@@ -17,18 +17,24 @@
  * this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "checkpoint.h"
 #include "engine.h"
 #include "extern/lz4frame.h"
 #include "game.h"
 #include "jobs.h"
 #include "openings.h"
 #include "options.h"
+#include "reactor.h"
+#include "remote.h"
 #include "seqwriter.h"
 #include "sprt.h"
 #include "util.h"
 #include "workers.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <csignal>
 #include <cstdlib>
 #include <iostream>
 #include <thread>
@@ -40,10 +46,16 @@ static JobQueue *                 jq;
 static SeqWriter *                pgnSeqWriter;
 static SeqWriter *                sgfSeqWriter;
 static SeqWriter *                msgSeqWriter;
+static SeqWriter *                statsSeqWriter;
+static Checkpoint *               checkpoint;
+static RemoteClient *             remote;  // in worker mode
+static std::vector<std::string>   outputs;  // names of the outputs of games
 static std::vector<Worker *>      workers;
 static FILE *                     sampleFile;
 static LZ4F_compressionContext_t  sampleFileLz4Ctx;
 
+static std::vector<ForbiddenCacheStats> forbiddenCacheStats;  // per thread
+
 // Compression preference for binary samples
 static const LZ4F_preferences_t LZ4Pref = {.frameInfo        = {},
                                            .compressionLevel = 3,
@@ -51,8 +63,45 @@ static const LZ4F_preferences_t LZ4Pref = {.frameInfo        = {},
                                            .favorDecSpeed    = 0,
                                            .reserved         = {}};
 
+// Write LZ4 frame header of compressed samples
+static void sample_frame_begin(void)
+{
+    char   buf[LZ4F_HEADER_SIZE_MAX];
+    size_t headerSize = LZ4F_compressBegin(sampleFileLz4Ctx, buf, sizeof(buf), &LZ4Pref);
+    fwrite(buf, sizeof(char), headerSize, sampleFile);
+}
+
+// Flush LZ4 tails of compressed samples
+static void sample_frame_end(void)
+{
+    const size_t bufSize = LZ4F_compressBound(0, nullptr);
+    char         buf[bufSize];
+    size_t       size = LZ4F_compressEnd(sampleFileLz4Ctx, buf, bufSize, nullptr);
+    fwrite(buf, 1, size, sampleFile);
+}
+
+// Flush the sample file for a checkpoint, and return its size. Compressed samples end
+// their frame there, so that a resumed run appends a frame of its own.
+static long sample_sync(void)
+{
+    if (options.sp.compress)
+        sample_frame_end();
+
+    DIE_IF(0, fflush(sampleFile) < 0);
+    DIE_IF(0, fseek(sampleFile, 0, SEEK_END) < 0);
+    const long size = ftell(sampleFile);
+
+    if (options.sp.compress)
+        sample_frame_begin();
+
+    return size;
+}
+
 static void main_destroy(void)
 {
+    // Engines terminated by force are reaped, and their cgroups removed
+    engine_reap_killed(true);
+
     for (Worker *worker : workers)
         delete worker;
     workers.clear();
@@ -60,10 +109,7 @@ static void main_destroy(void)
     if (sampleFile) {
         if (options.sp.compress) {
             // Flush LZ4 tails and release LZ4 context
-            const size_t bufSize = LZ4F_compressBound(0, nullptr);
-            char         buf[bufSize];
-            size_t       size = LZ4F_compressEnd(sampleFileLz4Ctx, buf, bufSize, nullptr);
-            fwrite(buf, 1, size, sampleFile);
+            sample_frame_end();
             LZ4F_freeCompressionContext(sampleFileLz4Ctx);
         }
         fclose(sampleFile);
@@ -75,53 +121,148 @@ static void main_destroy(void)
         delete sgfSeqWriter;
     if (msgSeqWriter)
         delete msgSeqWriter;
+    if (statsSeqWriter)
+        delete statsSeqWriter;
 
+    delete checkpoint;
+    delete remote;
     delete openings;
     delete jq;
 }
 
-static void main_init(int argc, const char **argv)
+// Opens the output files, and the checkpoint, resuming from it as asked
+static void open_outputs(void)
 {
-    atexit(main_destroy);
+    // Resuming from a checkpoint needs the same openings order, and output files
+    if (!options.checkpoint.empty())
+        checkpoint = new Checkpoint(options.checkpoint, options.checkpointSec * 1000, jq);
+    const bool resumed = options.resume && checkpoint->load();
 
-    initZobrish();
+    if (resumed
+        && (checkpoint->shard != options.shard || checkpoint->shards != options.shards))
+        DIE("checkpoint '%s' is of shard %d/%d\n",
+            options.checkpoint.c_str(),
+            checkpoint->shard,
+            checkpoint->shards);
 
-    options_parse(argc, argv, options, eo);
+    openings = new Openings(options.openings.c_str(),
+                            options.random,
+                            resumed ? checkpoint->seed : options.srand);
 
-    jq = new JobQueue((int)eo.size(), options.rounds, options.games, options.gauntlet);
-    openings = new Openings(options.openings.c_str(), options.random, options.srand);
+    // A shard writes from its first game on
+    const size_t firstIdx = jq->shard_first(options.shard, options.shards);
 
     if (!options.pgn.empty())
-        pgnSeqWriter = new SeqWriter(options.pgn.c_str(), "a" FOPEN_TEXT);
+        pgnSeqWriter = new SeqWriter(options.pgn.c_str(), "a" FOPEN_TEXT, firstIdx);
 
     if (!options.sgf.empty())
-        sgfSeqWriter = new SeqWriter(options.sgf.c_str(), "a" FOPEN_TEXT);
+        sgfSeqWriter = new SeqWriter(options.sgf.c_str(), "a" FOPEN_TEXT, firstIdx);
 
     if (!options.msg.empty())
-        msgSeqWriter = new SeqWriter(options.msg.c_str(), "a" FOPEN_TEXT);
+        msgSeqWriter = new SeqWriter(options.msg.c_str(), "a" FOPEN_TEXT, firstIdx);
+
+    if (!options.stats.empty())
+        statsSeqWriter = new SeqWriter(options.stats.c_str(), "a" FOPEN_TEXT, firstIdx);
 
     if (!options.sp.fileName.empty()) {
-        if (options.sp.compress) {
-            DIE_IF(0,
-                   !(sampleFile = fopen(options.sp.fileName.c_str(), "w" FOPEN_BINARY)));
-            // Init LZ4 context and write file headers
-            DIE_IF(0,
-                   LZ4F_isError(
-                       LZ4F_createCompressionContext(&sampleFileLz4Ctx, LZ4F_VERSION)));
-            char   buf[LZ4F_HEADER_SIZE_MAX];
-            size_t headerSize =
-                LZ4F_compressBegin(sampleFileLz4Ctx, buf, sizeof(buf), &LZ4Pref);
-            fwrite(buf, sizeof(char), headerSize, sampleFile);
-        }
-        else if (options.sp.bin) {
-            DIE_IF(0,
-                   !(sampleFile = fopen(options.sp.fileName.c_str(), "a" FOPEN_BINARY)));
-        }
-        else {
-            DIE_IF(0, !(sampleFile = fopen(options.sp.fileName.c_str(), "a" FOPEN_TEXT)));
+        // Compressed samples are not appended to a previous run, but to the checkpoint
+        const char *mode = options.sp.compress && !resumed ? "w" FOPEN_BINARY
+                           : options.sp.bin                ? "a" FOPEN_BINARY
+                                                           : "a" FOPEN_TEXT;
+        DIE_IF(0, !(sampleFile = fopen(options.sp.fileName.c_str(), mode)));
+    }
+
+    if (checkpoint) {
+        checkpoint->seed   = openings->seed;
+        checkpoint->shard  = options.shard;
+        checkpoint->shards = options.shards;
+        if (pgnSeqWriter)
+            checkpoint->add_writer("pgn", options.pgn, pgnSeqWriter);
+        if (sgfSeqWriter)
+            checkpoint->add_writer("sgf", options.sgf, sgfSeqWriter);
+        if (msgSeqWriter)
+            checkpoint->add_writer("msg", options.msg, msgSeqWriter);
+        if (statsSeqWriter)
+            checkpoint->add_writer("stats", options.stats, statsSeqWriter);
+        if (sampleFile)
+            checkpoint->add_samples(options.sp.fileName, sample_sync);
+
+        if (resumed) {
+            checkpoint->restore(sampleFile);
+            printf("Resume from %s: %zu of %zu games already played\n",
+                   options.checkpoint.c_str(),
+                   jq->completed.load(),
+                   jq->job_count());
+
+            // The SPRT may have concluded before the run was interrupted
+            int wldCount[3];
+            Result::unpack(jq->results[0].packed.load(), wldCount);
+            if (options.sprt && jq->completed.load() && options.sprtParam.done(wldCount))
+                jq->stop();
         }
     }
 
+    if (sampleFile && options.sp.compress) {
+        // Init LZ4 context and write file headers
+        DIE_IF(0,
+               LZ4F_isError(
+                   LZ4F_createCompressionContext(&sampleFileLz4Ctx, LZ4F_VERSION)));
+        sample_frame_begin();
+    }
+}
+
+static void main_init(int argc, const char **argv)
+{
+    atexit(main_destroy);
+
+#ifndef __MINGW32__
+    // A write to the pipe of a dead engine fails with EPIPE, taken as an engine crash,
+    // instead of killing the process
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    initZobrish();
+
+    options_parse(argc, argv, options, eo);
+
+    jq = new JobQueue((int)eo.size(),
+                      options.rounds,
+                      options.games,
+                      options.gauntlet,
+                      options.concurrency,
+                      options.schedule);
+
+    // Merge mode plays no game
+    if (!options.merge.empty())
+        return;
+
+    if (options.shards > 1)
+        jq->set_shard(options.shard, options.shards);
+
+    // Outputs of games, written by the coordinator in worker mode
+    if (!options.pgn.empty())
+        outputs.push_back("pgn");
+    if (!options.sgf.empty())
+        outputs.push_back("sgf");
+    if (!options.msg.empty())
+        outputs.push_back("msg");
+    if (!options.stats.empty())
+        outputs.push_back("stats");
+    if (!options.sp.fileName.empty())
+        outputs.push_back("samples");
+
+    if (!options.connect.empty()) {
+        remote =
+            new RemoteClient(options.connect.c_str(), *jq, outputs, options.concurrency);
+        openings = new Openings(options.openings.c_str(), options.random, remote->seed);
+    }
+    else
+        open_outputs();
+
+    // The coordinator plays no game
+    if (!options.serve.empty())
+        return;
+
     // Prepare Workers[]
     for (int i = 0; i < options.concurrency; i++) {
         std::string logName;
@@ -131,42 +272,176 @@ static void main_init(int argc, const char **argv)
         }
 
         workers.push_back(new Worker(i, logName.c_str()));
+        if (!options.cpuSets.empty())
+            workers.back()->cpus = options.cpuSets[i];
+    }
+
+    // No point in having more reactor threads than workers
+    options.reactorThreads = std::min(options.reactorThreads, options.concurrency);
+    forbiddenCacheStats.resize(options.concurrency);
+}
+
+// Next job of a worker, handed out by the coordinator in worker mode
+static bool next_job(Worker *w, Job &job, size_t &idx, size_t &count)
+{
+    if (!remote)
+        return jq->pop(w->id, job, idx, count);
+
+    if (!remote->pop(idx))
+        return false;
+    job   = jq->job_at(idx);
+    count = jq->job_count();
+    return true;
+}
+
+// Record of a game for one of the outputs
+static std::string game_record(const Game &       game,
+                               size_t             idx,
+                               const std::string &output,
+                               const std::string &messages)
+{
+    if (output == "pgn") {
+        const int pgnVerbosity = 0;
+        return game.export_pgn(idx + 1, pgnVerbosity);
+    }
+    else if (output == "sgf")
+        return game.export_sgf(idx + 1);
+    else if (output == "msg")
+        return messages;
+    else if (output == "stats")
+        return game.export_stats(idx + 1);
+
+    assert(output == "samples");
+    return game.export_samples(options.sp.bin);
+}
+
+// Append samples to the sample file, compressed as needed
+static void write_samples(const std::string &data)
+{
+    FileLock fl(sampleFile);
+
+    if (options.sp.compress) {
+        std::vector<char> buf(LZ4F_compressBound(data.size(), &LZ4Pref));
+        const size_t      size = LZ4F_compressUpdate(sampleFileLz4Ctx,
+                                                buf.data(),
+                                                buf.size(),
+                                                data.data(),
+                                                data.size(),
+                                                nullptr);
+        fwrite(buf.data(), 1, size, sampleFile);
     }
+    else
+        fwrite(data.data(), 1, data.size(), sampleFile);
+}
+
+// The records and result of a game are written at once as far as checkpoints are
+// concerned. Returns the number of games completed.
+static size_t record_game(size_t             idx,
+                          int                pair,
+                          int                wld,
+                          const GameRecords &records,
+                          int                wldCount[3])
+{
+    auto scope =
+        checkpoint ? checkpoint->game_scope() : std::shared_lock<std::shared_mutex>();
+
+    for (const auto &[output, data] : records) {
+        if (output == "pgn")
+            pgnSeqWriter->push(idx, data);
+        else if (output == "sgf")
+            sgfSeqWriter->push(idx, data);
+        else if (output == "msg")
+            msgSeqWriter->push(idx, data);
+        else if (output == "stats")
+            statsSeqWriter->push(idx, data);
+        else if (output == "samples" && !data.empty())
+            write_samples(data);
+    }
+
+    if (checkpoint)
+        checkpoint->game_done(idx);
+    return jq->add_result(pair, wld, wldCount);
+}
+
+// Coordinator: records a game played by a worker. Returns true when the SPRT stops the
+// run.
+static bool remote_record(size_t idx, int wld, const GameRecords &records)
+{
+    const Job    job         = jq->job_at(idx);
+    int          wldCount[3] = {0};
+    const size_t completed   = record_game(idx, job.pair, wld, records, wldCount);
+
+    const int n = wldCount[RESULT_WIN] + wldCount[RESULT_LOSS] + wldCount[RESULT_DRAW];
+    printf("Score of %s vs %s: %d - %d - %d  [%.3f] %d\n",
+           jq->get_name(job.ei[0]).c_str(),
+           jq->get_name(job.ei[1]).c_str(),
+           wldCount[RESULT_WIN],
+           wldCount[RESULT_LOSS],
+           wldCount[RESULT_DRAW],
+           (wldCount[RESULT_WIN] + 0.5 * wldCount[RESULT_DRAW]) / n,
+           n);
+
+    const bool stop = options.sprt && options.sprtParam.done(wldCount);
+    if (stop)
+        jq->stop();
+
+    if (eo.size() > 2)
+        jq->print_results(completed, (size_t)options.games);
+
+    if (checkpoint)
+        checkpoint->save_if_due();
+    return stop;
 }
 
 static void thread_start(Worker *w)
 {
-    std::string opening_str, messages;
-    Job         job   = {};
-    Engine engines[2] = {{w, options.debug, !options.msg.empty() ? &messages : nullptr},
-                         {w, options.debug, !options.msg.empty() ? &messages : nullptr}};
-    int    ei[2]      = {-1, -1};  // eo[ei[0]] plays eo[ei[1]]: initialize with invalid
-                                   // values to start
-    size_t idx = 0, count = 0;     // game idx and count (shared across workers)
-
-    while (jq->pop(job, idx, count)) {
+    std::string  opening_str, messages;
+    std::string *msg = !options.msg.empty() ? &messages : nullptr;
+    Job          job = {};
+    EnginePool   pool(w, options.debug, msg, options.spawnMode, options.enginePool);
+    Engine *     engines[2] = {nullptr, nullptr};
+    int          ei[2]      = {-1, -1};  // eo[ei[0]] plays eo[ei[1]]: initialize with
+                                         // invalid values to start
+    size_t idx = 0, count = 0;           // game idx and count (shared across workers)
+
+    while (next_job(w, job, idx, count)) {
         // Clear all previous engine messages and write game index
         if (!options.msg.empty()) {
             messages = "------------------------------\n";
             messages += format("Game ID: %zu\n", idx + 1);
         }
 
-        // Engine stop/start, as needed
+        // Engine swap, as needed. Both engines are released first, so that an engine
+        // changing side is handed back by the pool.
+        for (int i = 0; i < 2; i++)
+            if (job.ei[i] != ei[i] && engines[i]) {
+                pool.release(engines[i]);
+                engines[i] = nullptr;
+            }
+
+        const int64_t memLimit[2] = {
+            options.memLimit != MEMLIMIT_NONE ? eo[job.ei[0]].maxMemory : 0,
+            options.memLimit != MEMLIMIT_NONE ? eo[job.ei[1]].maxMemory : 0};
+
         for (int i = 0; i < 2; i++) {
-            if (job.ei[i] != ei[i]) {
-                ei[i] = job.ei[i];
-                engines[i].terminate();
-                engines[i].start(eo[ei[i]].cmd.c_str(),
-                                 eo[ei[i]].name.c_str(),
-                                 eo[ei[i]].tolerance);
-                jq->set_name(ei[i], engines[i].name);
+            if (!engines[i]) {
+                ei[i]      = job.ei[i];
+                engines[i] = pool.acquire(ei[i],
+                                          eo[ei[i]].cmd.c_str(),
+                                          eo[ei[i]].name.c_str(),
+                                          eo[ei[i]].tolerance,
+                                          memLimit[i]);
+                jq->set_name(ei[i], engines[i]->name);
+                if (remote)
+                    remote->send_name(ei[i], engines[i]->name);
             }
             // Re-init engine if it crashed/timeout previously
-            else if (!engines[i].is_ok() || engines[i].is_crashed()) {
-                engines[i].terminate();
-                engines[i].start(eo[ei[i]].cmd.c_str(),
-                                 eo[ei[i]].name.c_str(),
-                                 eo[ei[i]].tolerance);
+            else if (!engines[i]->is_ok() || engines[i]->is_crashed()) {
+                engines[i]->terminate();
+                engines[i]->start(eo[ei[i]].cmd.c_str(),
+                                  eo[ei[i]].name.c_str(),
+                                  eo[ei[i]].tolerance,
+                                  memLimit[i]);
             }
         }
 
@@ -189,36 +464,38 @@ static void thread_start(Worker *w)
                w->id,
                idx + 1,
                count,
-               engines[blackIdx].name.c_str(),
-               engines[whiteIdx].name.c_str());
+               engines[blackIdx]->name.c_str(),
+               engines[whiteIdx]->name.c_str());
 
         if (!options.msg.empty())
             messages += format("Engines: %s x %s\n",
-                               engines[blackIdx].name,
-                               engines[whiteIdx].name);
+                               engines[blackIdx]->name,
+                               engines[whiteIdx]->name);
 
         const EngineOptions *eoPair[2] = {&eo[ei[0]], &eo[ei[1]]};
         const int            wld       = game.play(options, engines, eoPair, job.reverse);
 
-        if (!options.gauntlet || !options.saveLoseOnly || wld == RESULT_LOSS) {
-            // Write to PGN file
-            if (pgnSeqWriter) {
-                const int pgnVerbosity = 0;
-                pgnSeqWriter->push(idx, game.export_pgn(idx + 1, pgnVerbosity));
-            }
-
-            // Write to SGF file
-            if (sgfSeqWriter)
-                sgfSeqWriter->push(idx, game.export_sgf(idx + 1));
-
-            // Write engine messages to TXT file
-            if (msgSeqWriter)
-                msgSeqWriter->push(idx, messages);
-
-            // Write to Sample file
-            if (sampleFile)
-                game.export_samples(sampleFile, options.sp.bin, sampleFileLz4Ctx);
+        // Games not saved are empty records, so that the next ones are not held back
+        const bool saved =
+            !options.gauntlet || !options.saveLoseOnly || wld == RESULT_LOSS;
+        GameRecords records;
+        for (const std::string &output : outputs)
+            records.emplace_back(output,
+                                 saved ? game_record(game, idx, output, messages) : "");
+
+        int    wldCount[3] = {0};
+        size_t completed   = 0;
+        if (remote) {
+            // The coordinator writes the records, the score printed is the worker's own
+            remote->send_result(idx, wld, records);
+            completed = jq->add_result(job.pair, wld, wldCount);
         }
+        else
+            completed = record_game(idx, job.pair, wld, records, wldCount);
+
+        // Engine usage summary, counted for all games
+        w->add_engine_usage(ei[blackIdx], game.usage[BLACK]);
+        w->add_engine_usage(ei[whiteIdx], game.usage[WHITE]);
 
         // Write to stdout a one line summary of the game
         const char *ResultTxt[3] = {"0-1", "1/2-1/2", "1-0"};  // Black-White
@@ -228,82 +505,208 @@ static void thread_start(Worker *w)
         printf("[%d] Finished game %zu (%s vs %s): %s {%s}\n",
                w->id,
                idx + 1,
-               engines[blackIdx].name.c_str(),
-               engines[whiteIdx].name.c_str(),
+               engines[blackIdx]->name.c_str(),
+               engines[whiteIdx]->name.c_str(),
                result.c_str(),
                reason.c_str());
 
-        // Pair update
-        int wldCount[3] = {0};
-        jq->add_result(job.pair, wld, wldCount);
         const int n =
             wldCount[RESULT_WIN] + wldCount[RESULT_LOSS] + wldCount[RESULT_DRAW];
         printf("Score of %s vs %s: %d - %d - %d  [%.3f] %d\n",
-               engines[0].name.c_str(),
-               engines[1].name.c_str(),
+               engines[0]->name.c_str(),
+               engines[1]->name.c_str(),
                wldCount[RESULT_WIN],
                wldCount[RESULT_LOSS],
                wldCount[RESULT_DRAW],
                (wldCount[RESULT_WIN] + 0.5 * wldCount[RESULT_DRAW]) / n,
                n);
 
-        // SPRT update
-        if (options.sprt && options.sprtParam.done(wldCount)) {
+        // SPRT update, made by the coordinator in worker mode
+        if (!remote && options.sprt && options.sprtParam.done(wldCount)) {
             jq->stop();
         }
 
         // Tournament update
         if (eo.size() > 2) {
-            jq->print_results((size_t)options.games);
+            jq->print_results(completed, (size_t)options.games);
         }
+
+        if (checkpoint)
+            checkpoint->save_if_due();
     }
 
-    for (int i = 0; i < 2; i++) {
-        engines[i].terminate();
+    // The pool terminates all engines when it goes out of scope
+
+    // In reactor mode, the thread is shared with other workers: see reactor_thread_exit()
+    if (!reactor_active())
+        forbiddenCacheStats[w->id - 1] = forbidden_cache_stats();
+}
+
+// Put the shards of a run together, as if it was played at once: their output files, as
+// named by the options, and the results
+static void main_merge()
+{
+    std::vector<std::pair<std::string, std::string>> files;
+    if (!options.pgn.empty())
+        files.emplace_back("pgn", options.pgn);
+    if (!options.sgf.empty())
+        files.emplace_back("sgf", options.sgf);
+    if (!options.msg.empty())
+        files.emplace_back("msg", options.msg);
+    if (!options.stats.empty())
+        files.emplace_back("stats", options.stats);
+    if (!options.sp.fileName.empty())
+        files.emplace_back("samples", options.sp.fileName);
+
+    Checkpoint::merge(options.merge, jq, files);
+    printf("Merged %zu shards: %zu games\n", options.merge.size(), jq->completed.load());
+    jq->print_results(jq->completed.load(), 1);
+
+    if (options.sprt) {
+        int wldCount[3];
+        Result::unpack(jq->results[0].packed.load(), wldCount);
+        options.sprtParam.done(wldCount);
     }
 }
 
-int main(int argc, const char **argv)
+// Coordinator: the games are played by the workers connecting, and recorded here
+static void main_serve()
 {
-    main_init(argc, argv);
+    Coordinator coordinator(options.serve.c_str(),
+                            jq,
+                            openings->seed,
+                            outputs,
+                            remote_record);
+    coordinator.run();
+
+    if (checkpoint)
+        checkpoint->save();
+}
+
+static void reactor_thread_exit(int threadIdx)
+{
+    forbiddenCacheStats[threadIdx] = forbidden_cache_stats();
+}
+
+// One thread per worker, the main thread enforcing deadlines
+static void run_threads()
+{
+    // We want some tolerance on small delays here. Given a choice, it's best to wait
+    // for the worker thread to notice an overdue deadline, which it will handled nicely
+    // by counting the game as lost for the offending engine, and continue. The deadline
+    // callbacks, run by the main thread, are the last resort solution.
+    Watchdog         watchdog;
+    std::atomic<int> running(options.concurrency);
 
     // Start threads[]
     std::vector<std::thread> threads;
 
     for (int i = 0; i < options.concurrency; i++) {
-        threads.emplace_back(thread_start, workers[i]);
+        workers[i]->watchdog = &watchdog;
+        threads.emplace_back([&, w = workers[i]] {
+            thread_start(w);
+            if (--running == 0)
+                watchdog.stop();
+        });
     }
 
-    // Main thread loop: check deadline overdue at regular intervals
-    do {
-        system_sleep(100);
-
-        // We want some tolerance on small delays here. Given a choice, it's
-        // best to wait for the worker thread to notice an overdue deadline,
-        // which it will handled nicely by counting the game as lost for the
-        // offending engine, and continue. Enforcing deadlines from the master
-        // thread is the last resort solution, because it is an unrecovrable
-        // error. At this point we are likely to face a completely unresponsive
-        // engine, where any attempt at I/O will block the master thread, on top
-        // of the already blocked worker. Hence, we must DIE().
-        for (int i = 0; i < options.concurrency; i++) {
-            int64_t overdue = workers[i]->deadline_overdue();
-            if (overdue > 0) {
-                workers[i]->deadline_callback_once();
-            }
-            else if (overdue > 1000) {
-                DIE("[%d] engine %s is unresponsive to [%s]\n",
-                    workers[i]->id,
-                    workers[i]->deadline.engineName.c_str(),
-                    workers[i]->deadline.description.c_str());
-            }
-        }
-    } while (!jq->done());
+    // Main thread loop: sleep until the next deadline expires
+    watchdog.run();
 
     // Join threads[]
     for (std::thread &th : threads) {
         th.join();
     }
+}
+
+int main(int argc, const char **argv)
+{
+    main_init(argc, argv);
+
+    if (!options.merge.empty()) {
+        main_merge();
+        return 0;
+    }
+
+    if (!options.serve.empty()) {
+        main_serve();
+        return 0;
+    }
+
+    // Reactor threads enforce the deadlines of their workers themselves
+    if (options.reactorThreads)
+        reactor_run(workers, options.reactorThreads, thread_start, reactor_thread_exit);
+    else
+        run_threads();
+
+    // Final checkpoint, with the games finished after the last periodic one
+    if (checkpoint)
+        checkpoint->save();
+
+    // Forbidden point cache summary, only renju games use it
+    ForbiddenCacheStats cacheStats;
+    for (const ForbiddenCacheStats &stats : forbiddenCacheStats) {
+        cacheStats.probes += stats.probes;
+        cacheStats.hits += stats.hits;
+    }
+    if (cacheStats.probes)
+        printf("Forbidden cache: %" PRIu64 " hits of %" PRIu64 " probes (%.1f%%)\n",
+               cacheStats.hits,
+               cacheStats.probes,
+               100.0 * cacheStats.hits / cacheStats.probes);
+
+    // Engine launch latency, to compare the spawn modes
+    uint64_t spawnCount = 0;
+    int64_t  spawnUsec  = 0;
+    for (const Worker *w : workers) {
+        spawnCount += w->spawnCount;
+        spawnUsec += w->spawnUsec;
+    }
+    if (spawnCount)
+        printf("Engine spawn (%s): %" PRIu64 " starts, %.3f ms average to ABOUT\n",
+               SpawnModeName[options.spawnMode],
+               spawnCount,
+               spawnUsec / 1000.0 / spawnCount);
+
+    // Engine changes between consecutive games of a thread, to compare the schedule modes
+    if (eo.size() > 2 && !remote) {
+        uint64_t    switches = 0;
+        std::string perWorker;
+        for (uint64_t s : jq->switches) {
+            switches += s;
+            perWorker += format(" %" PRIu64, s);
+        }
+        printf("Engine switches (%s schedule): %" PRIu64 " (per thread:%s)\n",
+               ScheduleModeName[options.schedule],
+               switches,
+               perWorker.c_str());
+    }
+
+    // Resources used by each engine, to tell CPU starvation apart from slow engines
+    std::vector<EngineUsage> engineUsage(eo.size());
+    for (const Worker *w : workers)
+        for (size_t ei = 0; ei < w->engineUsage.size(); ei++)
+            engineUsage[ei].add(w->engineUsage[ei]);
+    for (size_t ei = 0; ei < eo.size(); ei++) {
+        const EngineUsage &u = engineUsage[ei];
+        if (u.peakRssKB)
+            printf("Usage of %s: %" PRIu64 " moves, %.1f ms per move, CPU %.1f ms per "
+                   "move (%.1f%%), %.1f s CPU in total, %.1f MB peak RSS\n",
+                   jq->names[ei].c_str(),
+                   u.moves,
+                   (double)u.time / std::max<uint64_t>(u.moves, 1),
+                   (double)u.cpuMsec / std::max<uint64_t>(u.moves, 1),
+                   100.0 * u.cpuMsec / std::max<int64_t>(u.time, 1),
+                   u.exitCpuMsec / 1000.0,
+                   u.peakRssKB / 1024.0);
+    }
+
+    if (options.enginePool) {
+        uint64_t restartsAvoided = 0;
+        for (const Worker *w : workers)
+            restartsAvoided += w->restartsAvoided;
+        printf("Engine pool: %" PRIu64 " restarts avoided\n", restartsAvoided);
+    }
 
     return 0;
 }
@@ -21,7 +21,8 @@
 #include <cassert>
 #include <string>
 
-Openings::Openings(const char *fileName, bool random, uint64_t srand) : file(nullptr)
+Openings::Openings(const char *fileName, bool random, uint64_t srand)
+    : seed(0), file(nullptr)
 {
     if (*fileName) {
         DIE_IF(0, !(file = fopen(fileName, "r" FOPEN_TEXT)));
@@ -42,10 +43,11 @@ Openings::Openings(const char *fileName, bool random, uint64_t srand) : file(nul
             // allows consistent treatment of random and !random, and guarantees no
             // repetition N-cycles in the random case, rather than sqrt(N) (birthday
             // paradox) if random seek each time.
-            uint64_t seed = srand ? srand : (uint64_t)system_msec();
+            seed = srand ? srand : (uint64_t)system_msec();
 
+            uint64_t state = seed;
             for (size_t i = index.size() - 1; i > 0; i--) {
-                const size_t j   = prng(seed) % (i + 1);
+                const size_t j   = prng(state) % (i + 1);
                 long         tmp = index[i];
                 index[i]         = index[j];
                 index[j]         = tmp;
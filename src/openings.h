@@ -28,6 +28,8 @@ public:
 
     size_t next(std::string &opening_str, size_t idx, int threadId);
 
+    uint64_t seed;  // of the shuffle, 0 if not shuffled
+
 private:
     std::mutex        mtx;
     FILE *            file;
@@ -24,6 +24,12 @@
 #include <cstring>
 #include <iostream>
 
+#ifdef __linux__
+    #include <sched.h>
+#else
+    #define CPU_SETSIZE INT_MAX  // affinity is refused anyway
+#endif
+
 // Gomocup time control is in format 'matchtime|turntime' or only 'matchtime'
 static void options_parse_tc_gomocup(const char *s, EngineOptions &eo)
 {
@@ -54,6 +60,56 @@ static void options_parse_tc_gomocup(const char *s, EngineOptions &eo)
     eo.increment    = (int64_t)(increment * 1000);
 }
 
+// Parses a CPU list such as "0-3,8,10-11"
+static std::vector<int> options_parse_cpu_list(const char *s)
+{
+    std::vector<int> cpus;
+    std::string      token;
+
+    while ((s = string_tok(token, s, ","))) {
+        // "N" or "N-M", nothing else in the token
+        int       first = 0, last = 0, end = 0;
+        const int n = sscanf(token.c_str(), "%d%n-%d%n", &first, &end, &last, &end);
+        if (n == 1)
+            last = first;
+        if ((n != 1 && n != 2) || end != (int)token.size() || first < 0 || last < first
+            || last >= CPU_SETSIZE)
+            DIE("Illegal CPU range '%s'\n", token.c_str());
+
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+// Deals two CPUs to each worker, one for each engine of its game: physical cores first
+// with "auto", then their SMT siblings, or else in the order of the user list.
+static void options_cpu_sets(Options &o)
+{
+    if (o.affinity.empty())
+        return;
+
+#ifndef __linux__
+    DIE("CPU affinity is only available on Linux\n");
+#endif
+
+    const std::vector<int> cpus = o.affinity == "auto"
+                                      ? system_cpus()
+                                      : options_parse_cpu_list(o.affinity.c_str());
+    const size_t           need = 2 * (size_t)o.concurrency;
+
+    if (cpus.size() < need)
+        DIE("CPU affinity needs %zu CPUs for concurrency %d, only %zu given\n",
+            need,
+            o.concurrency,
+            cpus.size());
+
+    o.cpuSets.resize(o.concurrency);
+    for (int i = 0; i < o.concurrency; i++)
+        o.cpuSets[i] = {cpus[2 * i], cpus[2 * i + 1]};
+}
+
 static int options_parse_eo(int argc, const char **argv, int i, EngineOptions &eo)
 {
     while (i < argc && argv[i][0] != '-') {
@@ -234,6 +290,14 @@ void options_parse(int                         argc,
             o.log = true;
         else if (!strcmp(argv[i], "-concurrency"))
             o.concurrency = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-reactor")) {
+#ifndef __linux__
+            DIE("reactor mode is only available on Linux\n");
+#endif
+            o.reactorThreads = atoi(argv[++i]);
+            if (o.reactorThreads < 1)
+                DIE("Reactor mode needs at least 1 thread\n");
+        }
         else if (!strcmp(argv[i], "-each")) {
             i       = options_parse_eo(argc, argv, i + 1, each);
             eachSet = true;
@@ -255,6 +319,8 @@ void options_parse(int                         argc,
             o.sgf = argv[++i];
         else if (!strcmp(argv[i], "-msg"))
             o.msg = argv[++i];
+        else if (!strcmp(argv[i], "-stats"))
+            o.stats = argv[++i];
         else if (!strcmp(argv[i], "-resign"))
             i = options_parse_adjudication(argc,
                                            argv,
@@ -288,11 +354,105 @@ void options_parse(int                         argc,
             o.useTURN = false;
         else if (!strcmp(argv[i], "-fatalerror"))
             o.fatalError = true;
+        else if (!strcmp(argv[i], "-spawn")) {
+            i++;
+            if (!strcmp(argv[i], "vfork"))
+                o.spawnMode = SPAWN_VFORK;
+            else if (!strcmp(argv[i], "fork"))
+                o.spawnMode = SPAWN_FORK;
+            else
+                DIE("Illegal spawn mode '%s'\n", argv[i]);
+        }
+        else if (!strcmp(argv[i], "-schedule")) {
+            i++;
+            if (!strcmp(argv[i], "index"))
+                o.schedule = SCHEDULE_INDEX;
+            else if (!strcmp(argv[i], "pair"))
+                o.schedule = SCHEDULE_PAIR;
+            else
+                DIE("Illegal schedule mode '%s'\n", argv[i]);
+        }
+        else if (!strcmp(argv[i], "-memlimit")) {
+            o.memLimit = MEMLIMIT_RLIMIT;  // until memlimit_init() picks the mode
+            if (i + 1 < argc && string_prefix(argv[i + 1], "cgroup="))
+                o.memLimitCgroup = string_prefix(argv[++i], "cgroup=");
+        }
+        else if (!strcmp(argv[i], "-affinity"))
+            o.affinity = argv[++i];
+        else if (!strcmp(argv[i], "-checkpoint")) {
+            o.checkpoint = argv[++i];
+            if (i + 1 < argc && string_prefix(argv[i + 1], "interval="))
+                o.checkpointSec = atoi(string_prefix(argv[++i], "interval="));
+            if (o.checkpointSec < 1)
+                DIE("Illegal checkpoint interval %d\n", o.checkpointSec);
+        }
+        else if (!strcmp(argv[i], "-resume"))
+            o.resume = true;
+        else if (!strcmp(argv[i], "-shard")) {
+            i++;
+            if (sscanf(argv[i], "%d/%d", &o.shard, &o.shards) != 2 || o.shard < 1
+                || o.shard > o.shards)
+                DIE("Illegal shard '%s'\n", argv[i]);
+        }
+        else if (!strcmp(argv[i], "-merge")) {
+            while (i + 1 < argc && argv[i + 1][0] != '-')
+                o.merge.push_back(argv[++i]);
+            if (o.merge.empty())
+                DIE("-merge needs the checkpoint files of the shards\n");
+        }
+        else if (!strcmp(argv[i], "-serve"))
+            o.serve = argv[++i];
+        else if (!strcmp(argv[i], "-connect"))
+            o.connect = argv[++i];
+        else if (!strcmp(argv[i], "-enginepool")) {
+            o.enginePool = atoi(argv[i + 1]);
+            if (o.enginePool < 0)
+                DIE("Illegal engine pool size %d\n", o.enginePool);
+            i++;
+        }
         else {
             DIE("Unknown option '%s'\n", argv[i]);
         }
     }
 
+#ifndef __linux__
+    o.spawnMode = SPAWN_FORK;  // vfork mode needs clone()
+#endif
+
+    if (o.resume && o.checkpoint.empty())
+        DIE("-resume needs a -checkpoint file\n");
+
+    // Shards play the same games as a single run, and are merged from their checkpoints
+    if (o.shards > 1) {
+        if (o.checkpoint.empty())
+            DIE("-shard needs a -checkpoint file, to merge the shards\n");
+        if (o.random && !o.srand)
+            DIE("-shard with random openings needs their srand\n");
+        if (o.sprt)
+            DIE("-sprt needs the results of all shards, use it with -merge\n");
+    }
+
+    // Workers play the jobs of the coordinator, which keeps the results and output files
+    if (!o.serve.empty() || !o.connect.empty()) {
+#ifdef __MINGW32__
+        DIE("-serve and -connect are not available on Windows\n");
+#endif
+        if (!o.serve.empty() && !o.connect.empty())
+            DIE("-serve and -connect are exclusive\n");
+        if (!o.merge.empty() || o.shards > 1)
+            DIE("-serve and -connect cannot be used with -shard or -merge\n");
+        if (!o.connect.empty() && !o.checkpoint.empty())
+            DIE("-checkpoint is the coordinator's, not a worker's\n");
+        // A worker waiting for jobs would block the thread, and the games of all its fibers
+        if (!o.connect.empty() && o.reactorThreads)
+            DIE("-connect cannot be used with -reactor\n");
+    }
+
+    options_cpu_sets(o);
+
+    if (o.memLimit != MEMLIMIT_NONE)
+        o.memLimit = memlimit_init(o.memLimitCgroup);
+
     if (eachSet) {
         for (size_t i = 0; i < eo.size(); i++) {
             if (!each.cmd.empty())
@@ -359,6 +519,18 @@ void options_print(const Options &o, const std::vector<EngineOptions> &eo)
     std::cout << "pgn = " << o.pgn << std::endl;
     std::cout << "sgf = " << o.sgf << std::endl;
     std::cout << "msg = " << o.msg << std::endl;
+    std::cout << "stats = " << o.stats << std::endl;
+    std::cout << "checkpoint = " << o.checkpoint << std::endl;
+    if (o.shards > 1)
+        std::cout << "shard = " << o.shard << "/" << o.shards << std::endl;
+    if (!o.checkpoint.empty()) {
+        std::cout << "checkpoint.interval = " << o.checkpointSec << std::endl;
+        std::cout << "resume = " << o.resume << std::endl;
+    }
+    if (!o.serve.empty())
+        std::cout << "serve = " << o.serve << std::endl;
+    if (!o.connect.empty())
+        std::cout << "connect = " << o.connect << std::endl;
     std::cout << "log = " << o.log << std::endl;
     std::cout << "sample = " << o.sp.fileName << std::endl;
     if (!o.sp.fileName.empty()) {
@@ -374,6 +546,7 @@ void options_print(const Options &o, const std::vector<EngineOptions> &eo)
     if (o.gauntlet)
         std::cout << "loseonly = " << o.saveLoseOnly << std::endl;
     std::cout << "concurrency = " << o.concurrency << std::endl;
+    std::cout << "reactor = " << o.reactorThreads << std::endl;
     std::cout << "games = " << o.games << std::endl;
     std::cout << "rounds = " << o.rounds << std::endl;
     std::cout << "resignCount = " << o.resignCount << std::endl;
@@ -382,6 +555,14 @@ void options_print(const Options &o, const std::vector<EngineOptions> &eo)
     std::cout << "drawScore = " << o.drawScore << std::endl;
     std::cout << "drawAfter = " << o.forceDrawAfter << std::endl;
     std::cout << "fatalerror = " << o.fatalError << std::endl;
+    std::cout << "spawn = " << SpawnModeName[o.spawnMode] << std::endl;
+    std::cout << "enginepool = " << o.enginePool << std::endl;
+    std::cout << "schedule = " << ScheduleModeName[o.schedule] << std::endl;
+    std::cout << "memlimit = " << MemLimitModeName[o.memLimit] << std::endl;
+    std::cout << "affinity = " << o.affinity << std::endl;
+    for (size_t i = 0; i < o.cpuSets.size(); i++)
+        std::cout << "affinity[" << i + 1 << "] = " << o.cpuSets[i][0] << ","
+                  << o.cpuSets[i][1] << std::endl;
     std::cout << "debug = " << o.debug << std::endl;
     std::cout << std::endl;
 
@@ -15,6 +15,8 @@
  */
 
 #pragma once
+#include "engine.h"
+#include "jobs.h"
 #include "position.h"
 #include "sprt.h"
 #include "workers.h"
@@ -33,18 +35,29 @@ struct SampleParams
 
 struct Options
 {
-    std::string  openings, pgn, sgf, msg;
+    std::string  openings, pgn, sgf, msg, stats;
+    std::string  checkpoint;  // empty for no checkpoint
+    std::string  serve, connect;  // address of the coordinator, when serving or a worker
+    std::string  affinity;  // "auto" or a CPU list, empty to not pin engines
+    std::string  memLimitCgroup;  // parent of the engine cgroups, empty for our own
     SampleParams sp;
-    SPRTParam    sprtParam   = {.elo0 = 0, .elo1 = 0, .alpha = 0.05, .beta = 0.05};
-    uint64_t     srand       = 0;
-    int          concurrency = 1;
+    SPRTParam    sprtParam      = {.elo0 = 0, .elo1 = 0, .alpha = 0.05, .beta = 0.05};
+    uint64_t     srand          = 0;
+    int          concurrency    = 1;
+    int          reactorThreads = 0;  // 0 for one thread per worker
+    int          enginePool     = 0;  // idle engines kept running per worker
+    int          checkpointSec  = 60;  // interval between checkpoints
     int          games = 1, rounds = 1;
+    int          shard = 1, shards = 1;  // play shard k (from 1) of n
     int          resignCount = 0, resignScore = 0;
     int          drawCount = 0, drawScore = 0;
     int          forceDrawAfter = 0;
     int          boardSize      = 15;
     GameRule     gameRule       = GOMOKU_FIVE_OR_MORE;
     OpeningType  openingType    = OPENING_OFFSET;
+    SpawnMode    spawnMode      = SPAWN_VFORK;
+    ScheduleMode schedule       = SCHEDULE_INDEX;
+    MemLimitMode memLimit       = MEMLIMIT_NONE;
     bool         useTURN        = true;
     bool         log            = false;
     bool         random         = false;
@@ -55,6 +68,13 @@ struct Options
     bool         saveLoseOnly   = false;
     bool         fatalError     = false;
     bool         debug          = false;
+    bool         resume         = false;
+
+    // Checkpoints of the shards to merge, instead of playing
+    std::vector<std::string> merge;
+
+    // CPUs of each worker (by id - 1), running its engines, as derived from affinity
+    std::vector<std::vector<int>> cpuSets;
 };
 
 struct EngineOptions
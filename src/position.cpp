@@ -18,10 +18,13 @@
 
 #include "util.h"
 
+#include <array>
 #include <cassert>
 #include <cctype>
+#include <charconv>
 #include <cstdio>
 #include <cstring>
+#include <immintrin.h>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -32,6 +35,387 @@ const Direction DIRECTION[4] = {1,
                                 Position::MaxBoardSize,
                                 Position::MaxBoardSize + 1};
 
+// Line bitboards: each line of the padded board, in each of the four directions, is a
+// 32 bit word. Lines are stored as rows, anti-diagonals, columns then diagonals, and the
+// bit of a cell is its padded y (rows) or padded x (other directions). Cells falling off
+// the padded board are never set, and are seen as walls.
+constexpr int lineIndex(Pos pos, int iDir)
+{
+    const int x = pos >> MAX_BOARD_SIZE_BIT;
+    const int y = pos & (Position::MaxBoardSize - 1);
+    switch (iDir) {
+    case 0: return x;                                        // DIRECTION[0]: y + 1
+    case 1: return Position::MaxBoardSize + x + y;           // DIRECTION[1]: x + 1, y - 1
+    case 2: return 3 * Position::MaxBoardSize - 1 + y;       // DIRECTION[2]: x + 1
+    default: return 5 * Position::MaxBoardSize - 2 + x - y;  // DIRECTION[3]: x + 1, y + 1
+    }
+}
+
+constexpr int lineBit(Pos pos, int iDir)
+{
+    return iDir == 0 ? pos & (Position::MaxBoardSize - 1) : pos >> MAX_BOARD_SIZE_BIT;
+}
+
+// Cells of the real board in each line word, by board size. Empty cells are the ones of
+// the mask without a stone, so that Position only stores the words of the two colors.
+struct LineMasks
+{
+    uint32_t mask[Position::RealBoardSize + 1][Position::LineCount];
+};
+
+constexpr LineMasks makeLineMasks()
+{
+    LineMasks masks {};
+    for (int size = 1; size <= Position::RealBoardSize; size++)
+        for (int x = 0; x < size; x++)
+            for (int y = 0; y < size; y++) {
+                const Pos pos = Pos((x + BOARD_BOUNDARY) * Position::MaxBoardSize + y
+                                    + BOARD_BOUNDARY);
+                for (int iDir = 0; iDir < 4; iDir++)
+                    masks.mask[size][lineIndex(pos, iDir)] |= 1u << lineBit(pos, iDir);
+            }
+    return masks;
+}
+
+constexpr LineMasks LineMask = makeLineMasks();
+
+// Line patterns: the cells at distance 1 to 5 from a point, on both sides of a line, are
+// encoded as a base 3 index where each cell is own (1), empty (2) or anything else (0).
+// The pattern table then tells what an own stone put on the point makes on this line.
+enum LinePattern : uint8_t {
+    PATTERN_FIVE        = 1,   // exactly five
+    PATTERN_OVERLINE    = 2,   // six or more
+    PATTERN_FOUR        = 4,   // one empty cell makes exactly five
+    PATTERN_OPEN_FOUR   = 8,   // two empty cells make five, from a line of four
+    PATTERN_LONG_FOUR   = 16,  // two empty cells make five, from a split line
+    PATTERN_THREE_LEFT  = 32,  // first non own cell towards -DIRECTION makes open four
+    PATTERN_THREE_RIGHT = 64,  // first non own cell towards +DIRECTION makes open four
+};
+
+constexpr int PatternHalf  = 5;      // cells looked at on each side of the point
+constexpr int PatternWidth = 2 * PatternHalf + 1;
+constexpr int PatternCount = 59049;  // 3^(PatternWidth - 1)
+
+// Length of the connection going through bit b of an 11 cell window, b being own
+constexpr int windowLength(uint32_t own, int b)
+{
+    const int before = b ? __builtin_clz(~(own << (32 - b))) : 0;
+    return 1 + before + __builtin_ctz(~(own >> (b + 1)));
+}
+
+// Same walk as Position::isOpenFourRef(), with an own stone put on bit b. Cells out of
+// the window are seen as walls. Returns 0 (none), 1 (open four) or 2 (long four).
+constexpr int windowOpenFour(uint32_t own, uint32_t empty, int b)
+{
+    own |= 1u << b;
+    int count = 1, five = 0;
+    int i = 0, j = 0;
+    for (i = 1; i < 5 && b - i >= 0; i++) {
+        if (own >> (b - i) & 1) {
+            count++;
+            continue;
+        }
+        else if (empty >> (b - i) & 1)
+            five += windowLength(own | 1u << (b - i), b - i) == 5;
+        break;
+    }
+    for (j = 1; five && j < 6 - i && b + j < PatternWidth; j++) {
+        if (own >> (b + j) & 1) {
+            count++;
+            continue;
+        }
+        else if (empty >> (b + j) & 1)
+            five += windowLength(own | 1u << (b + j), b + j) == 5;
+        break;
+    }
+    return five == 2 ? (count == 4 ? 1 : 2) : 0;
+}
+
+// Whether an own stone put on bit b makes a line of exactly four, with an empty cell on
+// both ends that makes exactly five. This is windowOpenFour() == 1, in a few operations.
+constexpr bool windowTrueOpenFour(uint32_t own, uint32_t empty, int b)
+{
+    own |= 1u << b;
+    const int first = b - (b ? __builtin_clz(~(own << (32 - b))) : 0);
+    const int last  = b + __builtin_ctz(~(own >> (b + 1)));
+    if (last - first != 3 || first < 1 || last > PatternWidth - 2)
+        return false;
+    return (empty >> (first - 1) & 1) && (empty >> (last + 1) & 1)
+           && !(first >= 2 && (own >> (first - 2) & 1)) && !(own >> (last + 2) & 1);
+}
+
+constexpr uint8_t windowPattern(uint32_t own, uint32_t empty)
+{
+    const int b       = PatternHalf;
+    int       pattern = 0;
+    const int len     = windowLength(own, b);
+    if (len == 5)
+        pattern |= PATTERN_FIVE;
+    else if (len > 5)
+        pattern |= PATTERN_OVERLINE;
+
+    const int openFour = windowOpenFour(own, empty, b);
+    if (openFour == 1)
+        pattern |= PATTERN_OPEN_FOUR;
+    else if (openFour == 2)
+        pattern |= PATTERN_LONG_FOUR;
+
+    // four: the first non own cell on either side makes exactly five
+    int i = 0, j = 0;
+    for (i = 1; i < 5; i++) {
+        if (own >> (b - i) & 1)
+            continue;
+        else if ((empty >> (b - i) & 1) && windowLength(own | 1u << (b - i), b - i) == 5)
+            pattern |= PATTERN_FOUR;
+        break;
+    }
+    for (j = 1; !(pattern & PATTERN_FOUR) && j < 6 - i; j++) {
+        if (own >> (b + j) & 1)
+            continue;
+        else if ((empty >> (b + j) & 1) && windowLength(own | 1u << (b + j), b + j) == 5)
+            pattern |= PATTERN_FOUR;
+        break;
+    }
+
+    // open three candidates: the first non own cell on either side makes an open four
+    for (i = 1; i < 5; i++) {
+        if (own >> (b - i) & 1)
+            continue;
+        else if ((empty >> (b - i) & 1) && windowTrueOpenFour(own, empty, b - i))
+            pattern |= PATTERN_THREE_LEFT;
+        break;
+    }
+    for (j = 1; j < 6 - i; j++) {
+        if (own >> (b + j) & 1)
+            continue;
+        else if ((empty >> (b + j) & 1) && windowTrueOpenFour(own, empty, b + j))
+            pattern |= PATTERN_THREE_RIGHT;
+        break;
+    }
+
+    return uint8_t(pattern);
+}
+
+constexpr std::array<uint8_t, PatternCount> makePatternTable()
+{
+    std::array<uint8_t, PatternCount> table {};
+    uint32_t own = 1u << PatternHalf, empty = 0;
+    for (int i = 0; i < PatternCount; i++) {
+        table[i] = windowPattern(own, empty);
+
+        // next index: count in base 3 on the window cells, the center skipped
+        for (int k = 0; k < PatternWidth; k++) {
+            if (k == PatternHalf)
+                continue;
+            const uint32_t bit = 1u << k;
+            if (own & bit) {  // 1 -> 2
+                own ^= bit;
+                empty |= bit;
+                break;
+            }
+            else if (!(empty & bit)) {  // 0 -> 1
+                own |= bit;
+                break;
+            }
+            empty ^= bit;  // 2 -> 0, carry
+        }
+    }
+    return table;
+}
+
+// Base 3 value of a 10 bit mask, each set bit counting as a digit 1
+constexpr std::array<uint16_t, 1 << (PatternWidth - 1)> makeBase3Table()
+{
+    std::array<uint16_t, 1 << (PatternWidth - 1)> table {};
+    for (int m = 0; m < (1 << (PatternWidth - 1)); m++) {
+        int value = 0;
+        for (int k = PatternWidth - 2; k >= 0; k--)
+            value = value * 3 + (m >> k & 1);
+        table[m] = uint16_t(value);
+    }
+    return table;
+}
+
+constexpr auto PatternTable = makePatternTable();
+constexpr auto Base3Table   = makeBase3Table();
+
+// Window of a line word around bit b, the center bit dropped. Bit b must lie on the real
+// board, so that the whole window is inside the 32 bit word.
+inline int lineWindow(uint32_t word, int b)
+{
+    const uint32_t w = (word >> (b - PatternHalf)) & ((1u << PatternWidth) - 1);
+    return (w & ((1u << PatternHalf) - 1)) | (w >> (PatternHalf + 1) << PatternHalf);
+}
+
+// Five scan of the line bitboards of one color: rows holds the row words of the padded
+// board, zero padded up to ScanRows words. For each row x, the five cell windows starting
+// on row x are tested in the four directions at once, with shifts of the row words. With
+// exact set, a five must not be part of a longer connection. The SIMD kernels test 4 or
+// 8 rows at a time, and only they are built for their instruction set, so that the
+// binary runs on any x86-64 CPU.
+constexpr int ScanRows = Position::MaxBoardSize + 16;
+
+static bool fiveScanScalar(const uint32_t *rows, bool exact)
+{
+    uint32_t found = 0;
+    for (int x = 1; x < Position::MaxBoardSize; x++) {
+        const uint32_t m0 = rows[x], m1 = rows[x + 1], m2 = rows[x + 2], m3 = rows[x + 3],
+                       m4 = rows[x + 4], before = rows[x - 1], after = rows[x + 5];
+
+        uint32_t h = m0 & m0 >> 1 & m0 >> 2 & m0 >> 3 & m0 >> 4;  // DIRECTION[0]
+        uint32_t a = m0 & m1 << 1 & m2 << 2 & m3 << 3 & m4 << 4;  // DIRECTION[1]
+        uint32_t v = m0 & m1 & m2 & m3 & m4;                      // DIRECTION[2]
+        uint32_t d = m0 & m1 >> 1 & m2 >> 2 & m3 >> 3 & m4 >> 4;  // DIRECTION[3]
+        if (exact) {
+            h &= ~(m0 << 1) & ~(m0 >> 5);
+            a &= ~(before >> 1) & ~(after << 5);
+            v &= ~before & ~after;
+            d &= ~(before << 1) & ~(after >> 5);
+        }
+        found |= h | a | v | d;
+    }
+    return found;
+}
+
+__attribute__((target("sse4.2"))) static inline __m128i
+and5(__m128i a, __m128i b, __m128i c, __m128i d, __m128i e)
+{
+    return _mm_and_si128(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d)), e);
+}
+
+__attribute__((target("sse4.2"))) static bool
+fiveScanSse42(const uint32_t *rows, bool exact)
+{
+    __m128i found = _mm_setzero_si128();
+    for (int x = 1; x < Position::MaxBoardSize; x += 4) {
+        const __m128i m0     = _mm_loadu_si128((const __m128i *)(rows + x));
+        const __m128i m1     = _mm_loadu_si128((const __m128i *)(rows + x + 1));
+        const __m128i m2     = _mm_loadu_si128((const __m128i *)(rows + x + 2));
+        const __m128i m3     = _mm_loadu_si128((const __m128i *)(rows + x + 3));
+        const __m128i m4     = _mm_loadu_si128((const __m128i *)(rows + x + 4));
+        const __m128i before = _mm_loadu_si128((const __m128i *)(rows + x - 1));
+        const __m128i after  = _mm_loadu_si128((const __m128i *)(rows + x + 5));
+
+        __m128i h = and5(m0,
+                         _mm_srli_epi32(m0, 1),
+                         _mm_srli_epi32(m0, 2),
+                         _mm_srli_epi32(m0, 3),
+                         _mm_srli_epi32(m0, 4));
+        __m128i a = and5(m0,
+                         _mm_slli_epi32(m1, 1),
+                         _mm_slli_epi32(m2, 2),
+                         _mm_slli_epi32(m3, 3),
+                         _mm_slli_epi32(m4, 4));
+        __m128i v = and5(m0, m1, m2, m3, m4);
+        __m128i d = and5(m0,
+                         _mm_srli_epi32(m1, 1),
+                         _mm_srli_epi32(m2, 2),
+                         _mm_srli_epi32(m3, 3),
+                         _mm_srli_epi32(m4, 4));
+        if (exact) {
+            h = _mm_andnot_si128(_mm_slli_epi32(m0, 1), h);
+            h = _mm_andnot_si128(_mm_srli_epi32(m0, 5), h);
+            a = _mm_andnot_si128(_mm_srli_epi32(before, 1), a);
+            a = _mm_andnot_si128(_mm_slli_epi32(after, 5), a);
+            v = _mm_andnot_si128(_mm_or_si128(before, after), v);
+            d = _mm_andnot_si128(_mm_slli_epi32(before, 1), d);
+            d = _mm_andnot_si128(_mm_srli_epi32(after, 5), d);
+        }
+        found = _mm_or_si128(found, _mm_or_si128(_mm_or_si128(h, a), _mm_or_si128(v, d)));
+    }
+    return !_mm_testz_si128(found, found);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+and5(__m256i a, __m256i b, __m256i c, __m256i d, __m256i e)
+{
+    return _mm256_and_si256(
+        _mm256_and_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, d)),
+        e);
+}
+
+__attribute__((target("avx2"))) static bool fiveScanAvx2(const uint32_t *rows, bool exact)
+{
+    __m256i found = _mm256_setzero_si256();
+    for (int x = 1; x < Position::MaxBoardSize; x += 8) {
+        const __m256i m0     = _mm256_loadu_si256((const __m256i *)(rows + x));
+        const __m256i m1     = _mm256_loadu_si256((const __m256i *)(rows + x + 1));
+        const __m256i m2     = _mm256_loadu_si256((const __m256i *)(rows + x + 2));
+        const __m256i m3     = _mm256_loadu_si256((const __m256i *)(rows + x + 3));
+        const __m256i m4     = _mm256_loadu_si256((const __m256i *)(rows + x + 4));
+        const __m256i before = _mm256_loadu_si256((const __m256i *)(rows + x - 1));
+        const __m256i after  = _mm256_loadu_si256((const __m256i *)(rows + x + 5));
+
+        __m256i h = and5(m0,
+                         _mm256_srli_epi32(m0, 1),
+                         _mm256_srli_epi32(m0, 2),
+                         _mm256_srli_epi32(m0, 3),
+                         _mm256_srli_epi32(m0, 4));
+        __m256i a = and5(m0,
+                         _mm256_slli_epi32(m1, 1),
+                         _mm256_slli_epi32(m2, 2),
+                         _mm256_slli_epi32(m3, 3),
+                         _mm256_slli_epi32(m4, 4));
+        __m256i v = and5(m0, m1, m2, m3, m4);
+        __m256i d = and5(m0,
+                         _mm256_srli_epi32(m1, 1),
+                         _mm256_srli_epi32(m2, 2),
+                         _mm256_srli_epi32(m3, 3),
+                         _mm256_srli_epi32(m4, 4));
+        if (exact) {
+            h = _mm256_andnot_si256(_mm256_slli_epi32(m0, 1), h);
+            h = _mm256_andnot_si256(_mm256_srli_epi32(m0, 5), h);
+            a = _mm256_andnot_si256(_mm256_srli_epi32(before, 1), a);
+            a = _mm256_andnot_si256(_mm256_slli_epi32(after, 5), a);
+            v = _mm256_andnot_si256(_mm256_or_si256(before, after), v);
+            d = _mm256_andnot_si256(_mm256_slli_epi32(before, 1), d);
+            d = _mm256_andnot_si256(_mm256_srli_epi32(after, 5), d);
+        }
+        found = _mm256_or_si256(
+            found,
+            _mm256_or_si256(_mm256_or_si256(h, a), _mm256_or_si256(v, d)));
+    }
+    return !_mm256_testz_si256(found, found);
+}
+
+typedef bool (*FiveScanFn)(const uint32_t *rows, bool exact);
+
+static const FiveScanFn FiveScan[NB_SCAN_KERNEL] = {fiveScanScalar,
+                                                    fiveScanSse42,
+                                                    fiveScanAvx2};
+
+const char *ScanKernelName[NB_SCAN_KERNEL] = {"scalar", "sse4.2", "avx2"};
+
+bool scan_kernel_supported(ScanKernel kernel)
+{
+    __builtin_cpu_init();
+    switch (kernel) {
+    case SCAN_SSE42: return __builtin_cpu_supports("sse4.2");
+    case SCAN_AVX2: return __builtin_cpu_supports("avx2");
+    default: return kernel == SCAN_SCALAR;
+    }
+}
+
+static ScanKernel scan_kernel_best()
+{
+    return scan_kernel_supported(SCAN_AVX2)    ? SCAN_AVX2
+           : scan_kernel_supported(SCAN_SSE42) ? SCAN_SSE42
+                                               : SCAN_SCALAR;
+}
+
+static ScanKernel scanKernel = scan_kernel_best();
+
+ScanKernel scan_kernel()
+{
+    return scanKernel;
+}
+
+void scan_kernel_set(ScanKernel kernel)
+{
+    assert(scan_kernel_supported(kernel));
+    scanKernel = kernel;
+}
+
 inline move_t buildMove(int x, int y, Color side)
 {
     assert(side == WHITE || side == BLACK);
@@ -53,27 +437,51 @@ inline Color opponent_color(Color c)
     return OPPSITE_COLOR[c];
 }
 
-inline Pos transformPos(Pos p, int boardsize, TransformType type)
+// Symmetry tables: all transforms are affine on the padded Pos. SymmetryBase[type][pos]
+// is the image of pos for s = 0 (a board of size 1), which can fall out of the padded
+// board, and every unit of s moves the image by SymmetryStep[type].
+struct SymmetryTables
+{
+    int16_t base[NB_TRANS][Position::MaxBoardSizeSqr];
+    int16_t step[NB_TRANS];
+};
+
+constexpr int symmetryImage(int x, int y, int s, int type)
 {
-    int x = CoordX(p), y = CoordY(p);
-    int s = boardsize - 1;
+    int tx = x, ty = y;
     switch (type) {
-    case ROTATE_90:  // (x, y) -> (y, s - x)
-        return POS(y, s - x);
-    case ROTATE_180:  // (x, y) -> (s - x, s - y)
-        return POS(s - x, s - y);
-    case ROTATE_270:  // (x, y) -> (s - y, x)
-        return POS(s - y, x);
-    case FLIP_X:  // (x, y) -> (x, s - y)
-        return POS(x, s - y);
-    case FLIP_Y:  // (x, y) -> (s - x, y)
-        return POS(s - x, y);
-    case FLIP_XY:  // (x, y) -> (y, x)
-        return POS(y, x);
-    case FLIP_YX:  // (x, y) -> (s - y, s - x)
-        return POS(s - y, s - x);
-    default: return POS(x, y);
+    case ROTATE_90: tx = y, ty = s - x; break;       // (x, y) -> (y, s - x)
+    case ROTATE_180: tx = s - x, ty = s - y; break;  // (x, y) -> (s - x, s - y)
+    case ROTATE_270: tx = s - y, ty = x; break;      // (x, y) -> (s - y, x)
+    case FLIP_X: ty = s - y; break;                  // (x, y) -> (x, s - y)
+    case FLIP_Y: tx = s - x; break;                  // (x, y) -> (s - x, y)
+    case FLIP_XY: tx = y, ty = x; break;             // (x, y) -> (y, x)
+    case FLIP_YX: tx = s - y, ty = s - x; break;     // (x, y) -> (s - y, s - x)
+    default: break;
     }
+    return (tx + BOARD_BOUNDARY) * Position::MaxBoardSize + ty + BOARD_BOUNDARY;
+}
+
+constexpr SymmetryTables makeSymmetryTables()
+{
+    SymmetryTables tables {};
+    for (int type = 0; type < NB_TRANS; type++) {
+        for (int p = 0; p < Position::MaxBoardSizeSqr; p++) {
+            const int x = (p >> MAX_BOARD_SIZE_BIT) - BOARD_BOUNDARY;
+            const int y = (p & (Position::MaxBoardSize - 1)) - BOARD_BOUNDARY;
+            tables.base[type][p] = int16_t(symmetryImage(x, y, 0, type));
+        }
+        tables.step[type] =
+            int16_t(symmetryImage(0, 0, 1, type) - symmetryImage(0, 0, 0, type));
+    }
+    return tables;
+}
+
+constexpr SymmetryTables Symmetry = makeSymmetryTables();
+
+inline Pos transformPos(Pos p, int boardsize, TransformType type)
+{
+    return Pos(Symmetry.base[type][p] + (boardsize - 1) * Symmetry.step[type]);
 }
 
 void Position::initBoard(int size)
@@ -83,12 +491,12 @@ void Position::initBoard(int size)
     moveCount    = 0;
     playerToMove = BLACK;
     key          = (uint64_t)0;
-    for (int i = 0; i < MaxBoardSizeSqr; i++) {
+    memset(lineBits, 0, sizeof(lineBits));
+    for (int i = 0; i < MaxBoardSizeSqr; i++)
         board[i] = (CoordX(i) >= 0 && CoordX(i) < boardSize && CoordY(i) >= 0
                     && CoordY(i) < boardSize)
                        ? EMPTY
                        : WALL;
-    }
     winConnectionLen = 0;
 }
 
@@ -124,33 +532,29 @@ void Position::transform(TransformType type)
     if (type == IDENTITY)
         return;
 
-    // Clear previous board stones
-    Color tmpBoard[MaxBoardSizeSqr];
-    memcpy(tmpBoard, board, sizeof(tmpBoard));
-    for (int x = 0; x < boardSize; x++)
-        for (int y = 0; y < boardSize; y++) {
-            Pos pos = POS(x, y);
-            if (board[pos] != EMPTY)
-                delPiece(pos);  // delete prev stone if exists
-        }
-
-    // Transform all board cells and zobrist key
-    for (int x = 0; x < boardSize; x++)
-        for (int y = 0; y < boardSize; y++) {
-            Pos pos            = POS(x, y);
-            Pos transformedPos = transformPos(pos, boardSize, type);
-            if (tmpBoard[pos] != EMPTY)
-                setPiece(transformedPos, tmpBoard[pos]);
-        }
+    // The stones on board are the history moves: lift them all first, as an image can
+    // land on a stone not yet moved
+    Color stones[MaxMoves];
+    for (int i = 0; i < moveCount; i++) {
+        Pos pos    = PosFromMove(historyMoves[i]);
+        stones[i]  = board[pos];
+        board[pos] = EMPTY;
+    }
+    memset(lineBits, 0, sizeof(lineBits));
 
-    // Transform all history moves
+    // Single gather pass over board, history moves and zobrist key
+    const int16_t *base = Symmetry.base[type];
+    const int      step = (boardSize - 1) * Symmetry.step[type];
     for (int i = 0; i < moveCount; i++) {
-        move_t move            = historyMoves[i];
-        Pos    pos             = PosFromMove(move);
-        Color  color           = ColorFromMove(move);
-        Pos    transformedPos  = transformPos(pos, boardSize, type);
-        move_t transformedMove = buildMovePos(transformedPos, color);
-        historyMoves[i]        = transformedMove;
+        const move_t move           = historyMoves[i];
+        const Pos    pos            = PosFromMove(move);
+        const Pos    transformedPos = Pos(base[pos] + step);
+        assert(isInBoard(transformedPos));
+
+        board[transformedPos] = stones[i];
+        flipLineBits(transformedPos, stones[i]);
+        key ^= zobristPc[stones[i]][pos] ^ zobristPc[stones[i]][transformedPos];
+        historyMoves[i] = buildMovePos(transformedPos, ColorFromMove(move));
     }
 
     // Transform all win connection
@@ -168,8 +572,8 @@ void Position::print() const
     }
     std::cout << std::endl;
 
-    Color bd2[1024];
-    memcpy(bd2, board, 1024 * sizeof(Color));
+    Color bd2[MaxBoardSizeSqr];
+    memcpy(bd2, board, sizeof(bd2));
 
     for (int i = 0; i < winConnectionLen; i++) {
         bd2[winConnectionPos[i]] = WALL;
@@ -207,6 +611,7 @@ void Position::setPiece(Pos pos, Color piece)
     assert(board[pos] == EMPTY);
     board[pos] = piece;
     key ^= zobristPc[piece][pos];
+    flipLineBits(pos, piece);
 }
 
 void Position::delPiece(Pos pos)
@@ -214,9 +619,17 @@ void Position::delPiece(Pos pos)
     assert(isInBoard(pos));
     assert(board[pos] == WHITE || board[pos] == BLACK);
     key ^= zobristPc[board[pos]][pos];
+    flipLineBits(pos, board[pos]);
     board[pos] = EMPTY;
 }
 
+// toggles pos between EMPTY and piece in the line bitboards
+void Position::flipLineBits(Pos pos, Color piece)
+{
+    for (int iDir = 0; iDir < 4; iDir++)
+        lineBits[piece][lineIndex(pos, iDir)] ^= 1u << lineBit(pos, iDir);
+}
+
 bool Position::isInBoard(Pos pos) const
 {
     assert(pos < MaxBoardSizeSqr);
@@ -252,7 +665,53 @@ ForbiddenType Position::check_forbidden_move(move_t move) const
     // Check forbidden point using recursive finder
     // Note that forbidden point finder needs an empty pos to judge.
     assert(board[pos] == EMPTY);
-    return const_cast<Position *>(this)->isForbidden(pos);
+    ForbiddenType type = const_cast<Position *>(this)->isForbidden(pos);
+
+    // Debug build: the line bitboard finder must agree with the reference finder
+    assert(type == check_forbidden_move_ref(move));
+    return type;
+}
+
+ForbiddenType Position::check_forbidden_move_ref(move_t move) const
+{
+    Pos   pos   = PosFromMove(move);
+    Color color = ColorFromMove(move);
+    if (color != BLACK)
+        return FORBIDDEN_NONE;
+
+    assert(board[pos] == EMPTY);
+    return const_cast<Position *>(this)->isForbiddenRef(pos);
+}
+
+int Position::check_line_patterns_ref(move_t move) const
+{
+    Pos       pos   = PosFromMove(move);
+    Color     piece = ColorFromMove(move);
+    Position &self  = *const_cast<Position *>(this);
+
+    assert(board[pos] == EMPTY);
+    uint8_t       patterns[4];
+    const uint8_t all = linePatterns(pos, piece, patterns);
+
+    // fours and threes are only looked at once five and overline are ruled out
+    const bool ruledOut =
+        (all & PATTERN_FIVE) || (piece == BLACK && (all & PATTERN_OVERLINE));
+    int mismatches = bool(all & PATTERN_OVERLINE) != self.isOverlineRef(pos, piece);
+
+    for (int iDir = 0; iDir < 4; iDir++) {
+        const uint8_t p = patterns[iDir];
+        mismatches += bool(p & PATTERN_FIVE) != self.isFiveRef(pos, piece, iDir);
+        mismatches +=
+            (!ruledOut && (p & PATTERN_FOUR)) != self.isFourRef(pos, piece, iDir);
+        mismatches +=
+            self.isOpenFour(pos, piece, iDir) != self.isOpenFourRef(pos, piece, iDir);
+
+        const bool three = !ruledOut && (p & (PATTERN_THREE_LEFT | PATTERN_THREE_RIGHT))
+                           && self.isOpenThree(pos, piece, iDir, p);
+        mismatches += three != self.isOpenThreeRef(pos, piece, iDir);
+    }
+
+    return mismatches;
 }
 
 void Position::check_five_helper(bool allow_long_connc,
@@ -283,10 +742,25 @@ void Position::check_five_helper(bool allow_long_connc,
 // check if there exist any line-of-n-piece-in-same-color exists for side-to-move
 // if allow_long_connection, return true if n >= 5
 // if allow_long_connection, return true if and only if n == 5
+// A SIMD scan of the line bitboards rules out most positions, the walk over all lines
+// then records the connection.
 bool Position::check_five_in_line_side(Color side, bool allow_long_connection)
 {  // const {
     assert(side == WHITE || side == BLACK);
 
+    uint32_t rows[ScanRows] = {};
+    memcpy(rows, lineBits[side], MaxBoardSize * sizeof(uint32_t));
+    if (!FiveScan[scanKernel](rows, !allow_long_connection))
+        return false;
+
+    return check_five_in_line_side_ref(side, allow_long_connection);
+}
+
+// reference walk over all lines of the board
+bool Position::check_five_in_line_side_ref(Color side, bool allow_long_connection)
+{  // const {
+    assert(side == WHITE || side == BLACK);
+
     int i, j, k;
     int fiveCount = 0;
     Pos connectionLine[32];
@@ -400,6 +874,11 @@ bool Position::check_five_in_line_side(Color side, bool allow_long_connection)
     return false;
 }
 
+// check if the last move has made a line-of-n-piece-in-same-color. Only the four lines
+// passing through the last stone are walked, since any other line on the board has
+// already been checked after its own last stone was placed.
+// This gives the same result as check_five_in_line_side() on the side of the last move,
+// which is kept as the full board scan reference.
 bool Position::check_five_in_line_lastmove(bool allow_long_connection)
 {  // const {
     if (moveCount < 5) {
@@ -407,71 +886,103 @@ bool Position::check_five_in_line_lastmove(bool allow_long_connection)
     }
     Pos   lastPos   = PosFromMove(historyMoves[moveCount - 1]);
     Color lastPiece = board[lastPos];
-    return check_five_in_line_side(lastPiece, allow_long_connection);
-}
 
-move_t Position::gomostr_to_move(std::string_view movestr) const
-{
-    int    commaCount = 0;
-    size_t commaIdx   = 0;
-    for (size_t i = 0; i < movestr.length(); i++) {
-        if (movestr[i] == ',') {
-            commaIdx = i;
-            commaCount++;
-        }
-    }
-
-    assert(commaCount == 1);
+    for (int iDir = 0; iDir < 4; iDir++) {
+        const uint8_t pattern = linePattern(lastPos, lastPiece, iDir);
+        if (!(pattern & PATTERN_FIVE)
+            && !(allow_long_connection && (pattern & PATTERN_OVERLINE)))
+            continue;
 
-    size_t      secondLen = movestr.length() - commaIdx - 1;
-    std::string xstr {movestr.substr(0, commaIdx)};
-    std::string ystr {movestr.substr(commaIdx + 1, secondLen)};
+        // go back to the first stone of the connection along this direction
+        const Direction dir   = DIRECTION[iDir];
+        Pos             start = lastPos;
+        while (board[start - dir] == lastPiece)
+            start -= dir;
 
-    int x = std::stoi(xstr);
-    int y = std::stoi(ystr);
-    assert(x >= 0 && x < boardSize);
-    assert(y >= 0 && y < boardSize);
+        int continueCount = 0;
+        int fiveCount     = 0;
+        Pos connectionLine[RealBoardSize];
+        for (Pos p = start; board[p] == lastPiece; p += dir)
+            connectionLine[continueCount++] = p;
 
-    return buildMove(x, y, playerToMove);
+        check_five_helper(allow_long_connection,
+                          continueCount,
+                          fiveCount,
+                          connectionLine);
+        if (fiveCount > 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
-static bool isNumber(std::string &str)
+// Parses one coordinate of a move string. Leading blanks and sign are accepted, as
+// strtol() did.
+static MoveStrError parse_coord(const char *first, const char *last, int &value)
 {
-    char *p;
-    strtol(str.c_str(), &p, 10);
-    return !*p;
+    while (first < last && isspace((unsigned char)*first))
+        first++;
+    if (last - first > 1 && *first == '+' && isdigit((unsigned char)first[1]))
+        first++;
+
+    const auto [ptr, ec] = std::from_chars(first, last, value);
+    if (ptr != last || ptr == first)
+        return MOVESTR_SYNTAX;
+    else if (ec == std::errc::result_out_of_range)
+        return MOVESTR_OUT_OF_BOARD;
+    else
+        return ec == std::errc() ? MOVESTR_OK : MOVESTR_SYNTAX;
 }
 
-bool Position::is_valid_move_gomostr(std::string_view movestr)
+// Parses "x,y", without allocation nor range check
+MoveStrError Position::parse_gomostr(std::string_view movestr, int &x, int &y)
 {
-    int    commaCount = 0;
-    size_t commaIdx   = 0;
-    for (size_t i = 0; i < movestr.length(); i++) {
-        if (movestr[i] == ',') {
-            commaIdx = i;
-            commaCount++;
-        }
-    }
-
-    if (commaCount != 1) {
-        return false;  // no comma, or more than one comma?
-    }
+    const size_t commaIdx = movestr.find(',');
+    if (commaIdx == std::string_view::npos
+        || movestr.find(',', commaIdx + 1) != std::string_view::npos)
+        return MOVESTR_SYNTAX;  // no comma, or more than one comma
+
+    const char * first = movestr.data();
+    MoveStrError errx  = parse_coord(first, first + commaIdx, x);
+    MoveStrError erry  = parse_coord(first + commaIdx + 1, first + movestr.size(), y);
+
+    if (errx == MOVESTR_SYNTAX || erry == MOVESTR_SYNTAX)
+        return MOVESTR_SYNTAX;
+    return errx != MOVESTR_OK ? errx : erry;
+}
 
-    size_t      secondLen = movestr.length() - commaIdx - 1;
-    std::string xstr {movestr.substr(0, commaIdx)};
-    std::string ystr {movestr.substr(commaIdx + 1, secondLen)};
+MoveStrError Position::gomostr_to_move(std::string_view movestr, move_t &move) const
+{
+    int          x, y;
+    MoveStrError err = parse_gomostr(movestr, x, y);
+    if (err != MOVESTR_OK)
+        return err;
+    else if (x < 0 || x >= boardSize || y < 0 || y >= boardSize)
+        return MOVESTR_OUT_OF_BOARD;
+
+    move = buildMove(x, y, playerToMove);
+    return MOVESTR_OK;
+}
 
-    // any of two coords are not number
-    return isNumber(xstr) && isNumber(ystr);
+// any line with two numbers around a single comma, out of board moves included
+bool Position::is_valid_move_gomostr(std::string_view movestr)
+{
+    int x, y;
+    return parse_gomostr(movestr, x, y) != MOVESTR_SYNTAX;
 }
 
-std::string Position::move_to_gomostr(move_t move) const
+// Writes "x,y" to [first, last), without a terminating null
+std::to_chars_result Position::move_to_gomostr(move_t move, char *first, char *last)
 {
-    int               x = CoordX(PosFromMove(move));
-    int               y = CoordY(PosFromMove(move));
-    std::stringstream ss("");
-    ss << x << "," << y;
-    return ss.str();
+    const Pos            p   = PosFromMove(move);
+    std::to_chars_result res = std::to_chars(first, last, CoordX(p));
+    if (res.ec != std::errc())
+        return res;
+    else if (res.ptr == last)
+        return {last, std::errc::value_too_large};
+
+    *res.ptr++ = ',';
+    return std::to_chars(res.ptr, last, CoordY(p));
 }
 
 std::string Position::move_to_opening_str(move_t move, OpeningType type) const
@@ -645,32 +1156,243 @@ void Position::move_with_copy(const Position &before, move_t m)
     move(m);
 }
 
-// renju helpers
+// Forbidden point cache: a direct mapped table of black forbidden checks, keyed by the
+// zobrist key of the stones and the point. The recursive open three checks look at the
+// same positions many times, and games sharing an opening do it again. Each thread owns
+// its table, so no locking is needed.
+struct ForbiddenCacheEntry
+{
+    uint64_t key;
+    uint16_t pos;  // 0 (a wall) for an unused entry
+    uint8_t  boardSize;
+    uint8_t  type;
+};
+
+constexpr int ForbiddenCacheBits = 15;
+
+static thread_local ForbiddenCacheEntry forbiddenCache[1 << ForbiddenCacheBits];
+static thread_local ForbiddenCacheStats forbiddenCacheStats;
+
+ForbiddenCacheStats forbidden_cache_stats()
+{
+    return forbiddenCacheStats;
+}
+
+void forbidden_cache_clear()
+{
+    memset(forbiddenCache, 0, sizeof(forbiddenCache));  // pos 0 marks an unused entry
+}
+
+// renju helpers, working on the line bitboards
 ForbiddenType Position::isForbidden(Pos pos)
 {
-    if (isDoubleThree(pos, BLACK))
+    if (board[pos] != EMPTY)
+        return FORBIDDEN_NONE;
+
+    uint8_t       patterns[4];
+    const uint8_t all = linePatterns(pos, BLACK, patterns);
+    if (all & (PATTERN_FIVE | PATTERN_OVERLINE))
+        return all & PATTERN_OVERLINE ? OVERLINE : FORBIDDEN_NONE;
+
+    // Only the points needing open three verifications are worth a cache probe
+    if (countThreeCandidates(patterns) < 2)
+        return isDoubleFour(patterns) ? DOUBLE_FOUR : FORBIDDEN_NONE;
+
+    const uint64_t stonesKey = key ^ zobristTurn[playerToMove];
+    const uint64_t hash      = stonesKey ^ (uint64_t)pos * 0x9E3779B97F4A7C15ULL;
+
+    ForbiddenCacheEntry &entry = forbiddenCache[hash >> (64 - ForbiddenCacheBits)];
+
+    forbiddenCacheStats.probes++;
+    if (entry.key == stonesKey && entry.pos == pos && entry.boardSize == boardSize) {
+        forbiddenCacheStats.hits++;
+        return (ForbiddenType)entry.type;
+    }
+
+    const ForbiddenType type = isDoubleThree(pos, BLACK, patterns) ? DOUBLE_THREE
+                               : isDoubleFour(patterns)            ? DOUBLE_FOUR
+                                                                   : FORBIDDEN_NONE;
+
+    // the recursion may have used the entry for another point meanwhile
+    entry = {stonesKey, (uint16_t)pos, (uint8_t)boardSize, (uint8_t)type};
+    return type;
+}
+
+uint8_t Position::linePattern(Pos pos, Color piece, int iDir) const
+{
+    const int line = lineIndex(pos, iDir);
+    const int b    = lineBit(pos, iDir);
+    const uint32_t empty =
+        LineMask.mask[boardSize][line] & ~(lineBits[BLACK][line] | lineBits[WHITE][line]);
+    return PatternTable[Base3Table[lineWindow(lineBits[piece][line], b)]
+                        + 2 * Base3Table[lineWindow(empty, b)]];
+}
+
+// line patterns of pos in the four directions, returns their union
+uint8_t Position::linePatterns(Pos pos, Color piece, uint8_t patterns[4]) const
+{
+    uint8_t all = 0;
+    for (int iDir = 0; iDir < 4; iDir++) {
+        patterns[iDir] = linePattern(pos, piece, iDir);
+        all |= patterns[iDir];
+    }
+    return all;
+}
+
+int Position::countThreeCandidates(const uint8_t patterns[4])
+{
+    int nCandidate = 0;
+    for (int iDir = 0; iDir < 4; iDir++)
+        nCandidate += (patterns[iDir] & (PATTERN_THREE_LEFT | PATTERN_THREE_RIGHT)) != 0;
+    return nCandidate;
+}
+
+bool Position::isOverline(Pos pos, Color piece)
+{
+    if (board[pos] != EMPTY)
+        return false;
+
+    uint8_t patterns[4];
+    return linePatterns(pos, piece, patterns) & PATTERN_OVERLINE;
+}
+
+Position::OpenFourType Position::isOpenFour(Pos pos, Color piece, int iDir)
+{
+    if (board[pos] != EMPTY || (piece != BLACK && piece != WHITE))
+        return OF_NONE;
+
+    uint8_t       patterns[4];
+    const uint8_t all = linePatterns(pos, piece, patterns);
+    if ((all & PATTERN_FIVE) || (piece == BLACK && (all & PATTERN_OVERLINE)))
+        return OF_NONE;
+
+    return patterns[iDir] & PATTERN_OPEN_FOUR   ? OF_TRUE
+           : patterns[iDir] & PATTERN_LONG_FOUR ? OF_LONG
+                                                : OF_NONE;
+}
+
+// Checks the open three candidates of a line pattern, the caller having ruled out five
+// and overline on pos. The candidate cells still need to pass the checks on the other
+// lines, with the stone put on pos. For black, an open four point can not be an
+// overline, so these are forbidden point checks, going through the cache.
+bool Position::isOpenThree(Pos pos, Color piece, int iDir, uint8_t pattern)
+{
+    bool openthree = false;
+    setPiece(pos, piece);
+
+    const int      b   = lineBit(pos, iDir);
+    const uint32_t own = lineBits[piece][lineIndex(pos, iDir)];
+    for (int side = 0; side < 2 && !openthree; side++) {
+        Pos posi;
+        if (side == 0 && (pattern & PATTERN_THREE_LEFT))
+            posi = pos - DIRECTION[iDir] * (1 + __builtin_clz(~(own << (32 - b))));
+        else if (side == 1 && (pattern & PATTERN_THREE_RIGHT))
+            posi = pos + DIRECTION[iDir] * (1 + __builtin_ctz(~(own >> (b + 1))));
+        else
+            continue;
+
+        if (isOpenFour(posi, piece, iDir) != OF_TRUE)
+            continue;
+        else if (piece == BLACK)
+            openthree = isForbidden(posi) == FORBIDDEN_NONE;
+        else
+            openthree = !isDoubleFour(posi, piece) && !isDoubleThree(posi, piece);
+    }
+
+    delPiece(pos);
+    return openthree;
+}
+
+bool Position::isDoubleFour(Pos pos, Color piece)
+{
+    if (board[pos] != EMPTY || (piece != BLACK && piece != WHITE))
+        return false;
+
+    uint8_t       patterns[4];
+    const uint8_t all = linePatterns(pos, piece, patterns);
+    if ((all & PATTERN_FIVE) || (piece == BLACK && (all & PATTERN_OVERLINE)))
+        return false;
+
+    return isDoubleFour(patterns);
+}
+
+// the caller having ruled out five and overline
+bool Position::isDoubleFour(const uint8_t patterns[4])
+{
+    int nFour = 0;
+    for (int iDir = 0; iDir < 4; iDir++) {
+        if (patterns[iDir] & PATTERN_LONG_FOUR)
+            nFour += 2;
+        else if (patterns[iDir] & PATTERN_FOUR)
+            nFour++;
+
+        if (nFour >= 2)
+            return true;
+    }
+
+    return false;
+}
+
+bool Position::isDoubleThree(Pos pos, Color piece)
+{
+    if (board[pos] != EMPTY || (piece != BLACK && piece != WHITE))
+        return false;
+
+    uint8_t       patterns[4];
+    const uint8_t all = linePatterns(pos, piece, patterns);
+    if ((all & PATTERN_FIVE) || (piece == BLACK && (all & PATTERN_OVERLINE)))
+        return false;
+
+    return isDoubleThree(pos, piece, patterns);
+}
+
+// the caller having ruled out five and overline
+bool Position::isDoubleThree(Pos pos, Color piece, const uint8_t patterns[4])
+{
+    // only lines with an open three candidate can count, and two of them are needed
+    int nCandidate = countThreeCandidates(patterns);
+    int nThree     = 0;
+    for (int iDir = 0; iDir < 4 && nThree + nCandidate >= 2; iDir++) {
+        if (!(patterns[iDir] & (PATTERN_THREE_LEFT | PATTERN_THREE_RIGHT)))
+            continue;
+
+        nCandidate--;
+        if (isOpenThree(pos, piece, iDir, patterns[iDir]))
+            nThree++;
+
+        if (nThree >= 2)
+            return true;
+    }
+
+    return false;
+}
+
+// reference renju helpers, walking the cell array
+ForbiddenType Position::isForbiddenRef(Pos pos)
+{
+    if (isDoubleThreeRef(pos, BLACK))
         return DOUBLE_THREE;
-    else if (isDoubleFour(pos, BLACK))
+    else if (isDoubleFourRef(pos, BLACK))
         return DOUBLE_FOUR;
-    else if (isOverline(pos, BLACK))
+    else if (isOverlineRef(pos, BLACK))
         return OVERLINE;
     else
         return FORBIDDEN_NONE;
 }
 
-bool Position::isFive(Pos pos, Color piece)
+bool Position::isFiveRef(Pos pos, Color piece)
 {
     if (board[pos] != EMPTY)
         return false;
 
     for (int iDir = 0; iDir < 4; iDir++) {
-        if (isFive(pos, piece, iDir))
+        if (isFiveRef(pos, piece, iDir))
             return true;
     }
     return false;
 }
 
-bool Position::isFive(Pos pos, Color piece, int iDir)
+bool Position::isFiveRef(Pos pos, Color piece, int iDir)
 {
     if (board[pos] != EMPTY)
         return false;
@@ -692,7 +1414,7 @@ bool Position::isFive(Pos pos, Color piece, int iDir)
     return count == 5;
 }
 
-bool Position::isOverline(Pos pos, Color piece)
+bool Position::isOverlineRef(Pos pos, Color piece)
 {
     if (board[pos] != EMPTY)
         return false;
@@ -718,13 +1440,13 @@ bool Position::isOverline(Pos pos, Color piece)
     return false;
 }
 
-bool Position::isFour(Pos pos, Color piece, int iDir)
+bool Position::isFourRef(Pos pos, Color piece, int iDir)
 {
     if (board[pos] != EMPTY)
         return false;
-    else if (isFive(pos, piece))
+    else if (isFiveRef(pos, piece))
         return false;
-    else if (piece == BLACK && isOverline(pos, BLACK))
+    else if (piece == BLACK && isOverlineRef(pos, BLACK))
         return false;
     else if (piece == BLACK || piece == WHITE) {
         bool four = false;
@@ -735,7 +1457,7 @@ bool Position::isFour(Pos pos, Color piece, int iDir)
             Pos posi = pos - DIRECTION[iDir] * i;
             if (board[posi] == piece)
                 continue;
-            else if (board[posi] == EMPTY && isFive(posi, piece, iDir))
+            else if (board[posi] == EMPTY && isFiveRef(posi, piece, iDir))
                 four = true;
             break;
         }
@@ -743,7 +1465,7 @@ bool Position::isFour(Pos pos, Color piece, int iDir)
             Pos posi = pos + DIRECTION[iDir] * j;
             if (board[posi] == piece)
                 continue;
-            else if (board[posi] == EMPTY && isFive(posi, piece, iDir))
+            else if (board[posi] == EMPTY && isFiveRef(posi, piece, iDir))
                 four = true;
             break;
         }
@@ -755,13 +1477,13 @@ bool Position::isFour(Pos pos, Color piece, int iDir)
         return false;
 }
 
-Position::OpenFourType Position::isOpenFour(Pos pos, Color piece, int iDir)
+Position::OpenFourType Position::isOpenFourRef(Pos pos, Color piece, int iDir)
 {
     if (board[pos] != EMPTY)
         return OF_NONE;
-    else if (isFive(pos, piece))
+    else if (isFiveRef(pos, piece))
         return OF_NONE;
-    else if (piece == BLACK && isOverline(pos, BLACK))
+    else if (piece == BLACK && isOverlineRef(pos, BLACK))
         return OF_NONE;
     else if (piece == BLACK || piece == WHITE) {
         setPiece(pos, piece);
@@ -777,7 +1499,7 @@ Position::OpenFourType Position::isOpenFour(Pos pos, Color piece, int iDir)
                 continue;
             }
             else if (board[posi] == EMPTY)
-                five += isFive(posi, piece, iDir);
+                five += isFiveRef(posi, piece, iDir);
             break;
         }
         for (j = 1; five && j < 6 - i; j++) {
@@ -787,7 +1509,7 @@ Position::OpenFourType Position::isOpenFour(Pos pos, Color piece, int iDir)
                 continue;
             }
             else if (board[posi] == EMPTY)
-                five += isFive(posi, piece, iDir);
+                five += isFiveRef(posi, piece, iDir);
             break;
         }
 
@@ -798,13 +1520,13 @@ Position::OpenFourType Position::isOpenFour(Pos pos, Color piece, int iDir)
         return OF_NONE;
 }
 
-bool Position::isOpenThree(Pos pos, Color piece, int iDir)
+bool Position::isOpenThreeRef(Pos pos, Color piece, int iDir)
 {
     if (board[pos] != EMPTY)
         return false;
-    else if (isFive(pos, piece))
+    else if (isFiveRef(pos, piece))
         return false;
-    else if (piece == BLACK && isOverline(pos, BLACK))
+    else if (piece == BLACK && isOverlineRef(pos, BLACK))
         return false;
     else if (piece == BLACK || piece == WHITE) {
         bool openthree = false;
@@ -815,8 +1537,8 @@ bool Position::isOpenThree(Pos pos, Color piece, int iDir)
             Pos posi = pos - DIRECTION[iDir] * i;
             if (board[posi] == piece)
                 continue;
-            else if (board[posi] == EMPTY && isOpenFour(posi, piece, iDir) == OF_TRUE
-                     && !isDoubleFour(posi, piece) && !isDoubleThree(posi, piece))
+            else if (board[posi] == EMPTY && isOpenFourRef(posi, piece, iDir) == OF_TRUE
+                     && !isDoubleFourRef(posi, piece) && !isDoubleThreeRef(posi, piece))
                 openthree = true;
             break;
         }
@@ -824,8 +1546,8 @@ bool Position::isOpenThree(Pos pos, Color piece, int iDir)
             Pos posi = pos + DIRECTION[iDir] * j;
             if (board[posi] == piece)
                 continue;
-            else if (board[posi] == EMPTY && isOpenFour(posi, piece, iDir) == OF_TRUE
-                     && !isDoubleFour(posi, piece) && !isDoubleThree(posi, piece))
+            else if (board[posi] == EMPTY && isOpenFourRef(posi, piece, iDir) == OF_TRUE
+                     && !isDoubleFourRef(posi, piece) && !isDoubleThreeRef(posi, piece))
                 openthree = true;
             break;
         }
@@ -837,18 +1559,18 @@ bool Position::isOpenThree(Pos pos, Color piece, int iDir)
         return false;
 }
 
-bool Position::isDoubleFour(Pos pos, Color piece)
+bool Position::isDoubleFourRef(Pos pos, Color piece)
 {
     if (board[pos] != EMPTY)
         return false;
-    else if (isFive(pos, piece))
+    else if (isFiveRef(pos, piece))
         return false;
 
     int nFour = 0;
     for (int iDir = 0; iDir < 4; iDir++) {
-        if (isOpenFour(pos, piece, iDir) == OF_LONG)
+        if (isOpenFourRef(pos, piece, iDir) == OF_LONG)
             nFour += 2;
-        else if (isFour(pos, piece, iDir))
+        else if (isFourRef(pos, piece, iDir))
             nFour++;
 
         if (nFour >= 2)
@@ -858,16 +1580,16 @@ bool Position::isDoubleFour(Pos pos, Color piece)
     return false;
 }
 
-bool Position::isDoubleThree(Pos pos, Color piece)
+bool Position::isDoubleThreeRef(Pos pos, Color piece)
 {
     if (board[pos] != EMPTY)
         return false;
-    else if (isFive(pos, piece))
+    else if (isFiveRef(pos, piece))
         return false;
 
     int nThree = 0;
     for (int iDir = 0; iDir < 4; iDir++) {
-        if (isOpenThree(pos, piece, iDir))
+        if (isOpenThreeRef(pos, piece, iDir))
             nThree++;
 
         if (nThree >= 2)
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <cassert>
+#include <charconv>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -26,7 +27,7 @@ typedef uint16_t Pos;
 
 const move_t NONE_MOVE = 0xFFFF;
 
-enum Color { BLACK, WHITE, EMPTY, WALL };
+enum Color : uint8_t { BLACK, WHITE, EMPTY, WALL };
 
 #define BOARD_BOUNDARY     5
 #define MAX_BOARD_SIZE_BIT 5
@@ -41,6 +42,9 @@ enum OpeningType { OPENING_OFFSET, OPENING_POS };
 
 enum ForbiddenType { FORBIDDEN_NONE, DOUBLE_THREE, DOUBLE_FOUR, OVERLINE };
 
+// Result of parsing a "x,y" move string
+enum MoveStrError { MOVESTR_OK, MOVESTR_SYNTAX, MOVESTR_OUT_OF_BOARD };
+
 enum TransformType {
     IDENTITY,    // (x, y) -> (x, y)
     ROTATE_90,   // (x, y) -> (y, s - x)
@@ -59,6 +63,8 @@ public:
     static const int MaxBoardSize    = 1 << MAX_BOARD_SIZE_BIT;
     static const int MaxBoardSizeSqr = MaxBoardSize * MaxBoardSize;
     static const int RealBoardSize   = MaxBoardSize - 2 * BOARD_BOUNDARY;
+    static const int MaxMoves        = RealBoardSize * RealBoardSize;
+    static const int LineCount       = 2 * MaxBoardSize + 2 * (2 * MaxBoardSize - 1);
 
     Position(int bSize = 15);
 
@@ -73,39 +79,52 @@ public:
     void transform(TransformType type);
     void move_with_copy(const Position &before, move_t m);
 
-    move_t      gomostr_to_move(std::string_view movestr) const;
-    std::string move_to_gomostr(move_t move) const;
-    std::string move_to_opening_str(move_t move, OpeningType type) const;
+    MoveStrError gomostr_to_move(std::string_view movestr, move_t &move) const;
+    std::string  move_to_opening_str(move_t move, OpeningType type) const;
+
+    static std::to_chars_result move_to_gomostr(move_t move, char *first, char *last);
 
     void print() const;
 
     bool          is_legal_move(move_t move) const;
     ForbiddenType check_forbidden_move(move_t move) const;
+    ForbiddenType check_forbidden_move_ref(move_t move) const;  // reference finder
+
+    // Number of line pattern table lookups differing from the reference walks, for a
+    // stone of the move color put on the move point
+    int check_line_patterns_ref(move_t move) const;
 
     bool check_five_in_line_side(Color side,
                                  bool  allow_long_connection = true);  // const;
+    bool check_five_in_line_side_ref(Color side,
+                                     bool  allow_long_connection = true);  // const;
     bool check_five_in_line_lastmove(bool allow_long_connection);     // const;
 
     // about opening
     bool        apply_opening(std::string_view opening_str, OpeningType type);
     std::string to_opening_str(OpeningType type) const;
 
-    static bool is_valid_move_gomostr(std::string_view movestr);
+    static bool         is_valid_move_gomostr(std::string_view movestr);
+    static MoveStrError parse_gomostr(std::string_view movestr, int &x, int &y);
 
 private:
+    // One byte per cell on the padded board, and history sized to the largest real
+    // board, to keep copies of Position cheap.
     Color    board[MaxBoardSizeSqr];
+    move_t   historyMoves[MaxMoves];
+    Pos      winConnectionPos[RealBoardSize];
+    uint32_t lineBits[NB_COLOR][LineCount];  // line bitboards of BLACK and WHITE stones
+    uint64_t key;
     int      boardSize;
     int      boardSizeSqr;
     int      moveCount;
-    move_t   historyMoves[MaxBoardSizeSqr];
-    Color    playerToMove;
-    uint64_t key;
     int      winConnectionLen;
-    Pos      winConnectionPos[32];
+    Color    playerToMove;
 
     void initBoard(int size);
     void setPiece(Pos pos, Color piece);
     void delPiece(Pos pos);
+    void flipLineBits(Pos pos, Color piece);
     bool isInBoard(Pos pos) const;
     bool isInBoardXY(int x, int y) const;
 
@@ -121,14 +140,27 @@ private:
     // renju helpers
     enum OpenFourType { OF_NONE, OF_TRUE /*_OOOO_*/, OF_LONG /*O_OOO_O*/ };
     ForbiddenType isForbidden(Pos pos);
-    bool          isFive(Pos pos, Color piece);
-    bool          isFive(Pos pos, Color piece, int iDir);
     bool          isOverline(Pos pos, Color piece);
-    bool          isFour(Pos pos, Color piece, int iDir);
     OpenFourType  isOpenFour(Pos pos, Color piece, int iDir);
-    bool          isOpenThree(Pos pos, Color piece, int iDir);
+    bool          isOpenThree(Pos pos, Color piece, int iDir, uint8_t pattern);
     bool          isDoubleFour(Pos pos, Color piece);
+    static bool   isDoubleFour(const uint8_t patterns[4]);
     bool          isDoubleThree(Pos pos, Color piece);
+    bool          isDoubleThree(Pos pos, Color piece, const uint8_t patterns[4]);
+    uint8_t       linePattern(Pos pos, Color piece, int iDir) const;
+    uint8_t       linePatterns(Pos pos, Color piece, uint8_t patterns[4]) const;
+    static int    countThreeCandidates(const uint8_t patterns[4]);
+
+    // reference renju helpers on the cell array, to validate the bitboard ones
+    ForbiddenType isForbiddenRef(Pos pos);
+    bool          isFiveRef(Pos pos, Color piece);
+    bool          isFiveRef(Pos pos, Color piece, int iDir);
+    bool          isOverlineRef(Pos pos, Color piece);
+    bool          isFourRef(Pos pos, Color piece, int iDir);
+    OpenFourType  isOpenFourRef(Pos pos, Color piece, int iDir);
+    bool          isOpenThreeRef(Pos pos, Color piece, int iDir);
+    bool          isDoubleFourRef(Pos pos, Color piece);
+    bool          isDoubleThreeRef(Pos pos, Color piece);
 };
 
 inline Color oppositeColor(Color color)
@@ -167,3 +199,23 @@ extern uint64_t zobristPc[4][Position::MaxBoardSizeSqr];
 extern uint64_t zobristTurn[4];
 
 void initZobrish();
+
+// Kernels of the five scan in check_five_in_line_side(). The best one supported by the
+// CPU is picked at startup, setting another one is meant for benchmarks.
+enum ScanKernel { SCAN_SCALAR, SCAN_SSE42, SCAN_AVX2, NB_SCAN_KERNEL };
+
+extern const char *ScanKernelName[NB_SCAN_KERNEL];
+
+bool       scan_kernel_supported(ScanKernel kernel);
+ScanKernel scan_kernel();
+void       scan_kernel_set(ScanKernel kernel);
+
+// Renju forbidden point cache statistics, counted per thread
+struct ForbiddenCacheStats
+{
+    uint64_t probes = 0;
+    uint64_t hits   = 0;
+};
+
+ForbiddenCacheStats forbidden_cache_stats();  // of the calling thread
+void                forbidden_cache_clear();  // of the calling thread
@@ -0,0 +1,249 @@
+/*
+ *  c-gomoku-cli, a command line interface for Gomocup engines. Copyright 2021 Chao Ma.
+ *  c-gomoku-cli is derived from c-chess-cli, originally authored by lucasart 2020.
+ *
+ *  c-gomoku-cli is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ *  c-gomoku-cli is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this
+ * program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "reactor.h"
+#include "util.h"
+#include "workers.h"
+
+#ifdef __linux__
+    #include <sys/epoll.h>
+    #include <sys/mman.h>
+    #include <ucontext.h>
+    #include <unistd.h>
+
+    #include <algorithm>
+    #include <cassert>
+    #include <cerrno>
+    #include <climits>
+    #include <deque>
+    #include <memory>
+    #include <thread>
+
+static const size_t FiberStackSize = 512 * 1024;  // committed lazily by the kernel
+
+// Fiber stack, with a PROT_NONE guard page below it: an overflow faults at once, instead
+// of silently corrupting the memory next to the stack
+struct FiberStack
+{
+    char * base = nullptr;  // of the mapping, guard page included
+    size_t guard, size;
+
+    explicit FiberStack(int id)
+        : guard((size_t)sysconf(_SC_PAGESIZE)), size(FiberStackSize)
+    {
+        void *p = mmap(nullptr,
+                       guard + size,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+                       -1,
+                       0);
+        DIE_IF(id, p == MAP_FAILED);
+        base = (char *)p;
+        DIE_IF(id, mprotect(base, guard, PROT_NONE) < 0);
+    }
+
+    FiberStack(const FiberStack &) = delete;
+    ~FiberStack() { munmap(base, guard + size); }
+
+    void *sp() const { return base + guard; }  // lowest address, as uc_stack wants
+};
+
+struct Fiber
+{
+    ucontext_t ctx;
+    FiberStack stack;
+    Worker *   w;
+    int64_t                 wakeTime = 0;  // when sleeping, 0 otherwise
+    bool                    waiting  = false;  // for a readable fd
+    bool                    done     = false;
+};
+
+struct Reactor
+{
+    ucontext_t          main;
+    std::deque<Fiber *> runnable;
+    int                 epfd;
+    void (*start)(Worker *);
+};
+
+static thread_local Reactor *reactor;
+static thread_local Fiber *  current;
+
+static void fiber_entry()
+{
+    reactor->start(current->w);
+    current->done = true;
+    // returning resumes reactor->main through uc_link
+}
+
+static void reactor_thread(std::vector<Worker *> workers,
+                           void (*start)(Worker *),
+                           void (*threadExit)(int),
+                           int threadIdx)
+{
+    Reactor  r;
+    Watchdog watchdog;  // never sleeps: the thread waits in epoll_wait() instead
+    r.start = start;
+    DIE_IF(0, (r.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0);
+    reactor = &r;
+
+    std::vector<std::unique_ptr<Fiber>> fibers;
+    for (Worker *w : workers) {
+        Fiber *f    = fibers.emplace_back(new Fiber {{}, FiberStack(w->id), w}).get();
+        w->watchdog = &watchdog;
+
+        DIE_IF(w->id, getcontext(&f->ctx) < 0);
+        f->ctx.uc_stack.ss_sp   = f->stack.sp();
+        f->ctx.uc_stack.ss_size = f->stack.size;
+        f->ctx.uc_link          = &r.main;
+        makecontext(&f->ctx, fiber_entry, 0);
+        r.runnable.push_back(f);
+    }
+
+    size_t                live = fibers.size();
+    std::vector<Worker *> fired;
+    struct epoll_event    events[64];
+
+    while (live) {
+        while (!r.runnable.empty()) {
+            current = r.runnable.front();
+            r.runnable.pop_front();
+            DIE_IF(0, swapcontext(&r.main, &current->ctx) < 0);
+            live -= current->done;
+            current = nullptr;
+        }
+
+        if (!live)
+            break;
+
+        // The deadline callbacks run here, while their fiber is suspended. A fiber
+        // waiting for its pipe is resumed, as the callback may have closed the pipe.
+        fired.clear();
+        int64_t wakeTime = watchdog.fire(&fired);
+        for (auto &f : fibers)
+            if (f->waiting
+                && std::find(fired.begin(), fired.end(), f->w) != fired.end()) {
+                f->waiting = false;
+                r.runnable.push_back(f.get());
+            }
+
+        if (!r.runnable.empty())
+            continue;
+
+        // Wait for pipes, until the next sleeping fiber or deadline is due
+        int64_t now = system_msec();
+        for (auto &f : fibers)
+            if (f->wakeTime && f->wakeTime < wakeTime)
+                wakeTime = f->wakeTime;
+
+        const int timeout = wakeTime == INT64_MAX
+                                ? -1
+                                : (int)std::clamp<int64_t>(wakeTime - now, 0, INT_MAX);
+        const int n       = epoll_wait(r.epfd, events, 64, timeout);
+        DIE_IF(0, n < 0 && errno != EINTR);
+
+        for (int i = 0; i < n; i++) {
+            Fiber *f = (Fiber *)events[i].data.ptr;
+            if (f->waiting) {
+                f->waiting = false;
+                r.runnable.push_back(f);
+            }
+        }
+
+        now = system_msec();
+        for (auto &f : fibers)
+            if (f->wakeTime && f->wakeTime <= now) {
+                f->wakeTime = 0;
+                r.runnable.push_back(f.get());
+            }
+    }
+
+    DIE_IF(0, close(r.epfd) < 0);
+    reactor = nullptr;
+
+    threadExit(threadIdx);
+}
+
+void reactor_run(const std::vector<Worker *> &workers,
+                 int                          threadCount,
+                 void (*start)(Worker *),
+                 void (*threadExit)(int))
+{
+    assert(threadCount > 0);
+
+    // Deal the workers round robin to the threads
+    std::vector<std::vector<Worker *>> assigned(threadCount);
+    for (size_t i = 0; i < workers.size(); i++)
+        assigned[i % threadCount].push_back(workers[i]);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++)
+        threads.emplace_back(reactor_thread, assigned[t], start, threadExit, t);
+
+    for (std::thread &th : threads)
+        th.join();
+}
+
+bool reactor_active()
+{
+    return current != nullptr;
+}
+
+void reactor_wait_readable(int fd)
+{
+    assert(current && !current->waiting);
+
+    // One shot, so that the fd stays registered but disarmed between two waits
+    struct epoll_event ev = {};
+    ev.events             = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr           = current;
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        DIE_IF(current->w->id, errno != ENOENT);
+        DIE_IF(current->w->id, epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &ev) < 0);
+    }
+
+    current->waiting = true;
+    DIE_IF(current->w->id, swapcontext(&current->ctx, &reactor->main) < 0);
+}
+
+void reactor_sleep(int64_t msec)
+{
+    assert(current);
+
+    current->wakeTime = system_msec() + std::max<int64_t>(msec, 1);
+    DIE_IF(current->w->id, swapcontext(&current->ctx, &reactor->main) < 0);
+}
+
+#else
+
+void reactor_run(const std::vector<Worker *> &, int, void (*)(Worker *), void (*)(int))
+{
+    DIE("reactor mode is only available on Linux\n");
+}
+
+bool reactor_active()
+{
+    return false;
+}
+
+void reactor_wait_readable(int) {}
+
+void reactor_sleep(int64_t msec)
+{
+    system_sleep(msec);
+}
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ *  c-gomoku-cli, a command line interface for Gomocup engines. Copyright 2021 Chao Ma.
+ *  c-gomoku-cli is derived from c-chess-cli, originally authored by lucasart 2020.
+ *
+ *  c-gomoku-cli is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ *  c-gomoku-cli is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this
+ * program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cinttypes>
+#include <vector>
+
+class Worker;
+
+// Reactor mode (Linux only): instead of one thread per worker, each worker runs as a
+// fiber, and a small pool of threads drives all the fibers. A fiber blocked on an engine
+// pipe is suspended, and resumed by its thread when epoll reports the pipe readable, so
+// the game logic stays written as plain blocking code. Deadlines of the workers are
+// enforced by their reactor thread.
+
+// Runs start(w) for each worker on threadCount threads, and returns once all of them
+// have returned. threadExit(t) is called by the t-th thread before it exits.
+void reactor_run(const std::vector<Worker *> &workers,
+                 int                          threadCount,
+                 void (*start)(Worker *),
+                 void (*threadExit)(int));
+
+// true when called from a fiber of the reactor
+bool reactor_active();
+
+// Suspends the calling fiber until fd is readable, or its worker deadline is overdue
+void reactor_wait_readable(int fd);
+
+// Suspends the calling fiber for msec milliseconds
+void reactor_sleep(int64_t msec);
@@ -0,0 +1,523 @@
+/*
+ *  c-gomoku-cli, a command line interface for Gomocup engines. Copyright 2021 Chao Ma.
+ *  c-gomoku-cli is derived from c-chess-cli, originally authored by lucasart 2020.
+ *
+ *  c-gomoku-cli is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ *  c-gomoku-cli is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this
+ * program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "remote.h"
+
+#include "workers.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef __MINGW32__
+    #include <arpa/inet.h>
+    #include <fcntl.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+
+    #ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+    #endif
+
+// Engines must not inherit the sockets, and messages are small ones waiting for an answer
+static void socket_setup(int fd)
+{
+    DIE_IF(0, fcntl(fd, F_SETFD, FD_CLOEXEC) < 0);
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // fails on Unix sockets
+}
+
+// Listening or connected socket for "unix:PATH" or "HOST:PORT", HOST being a numeric
+// address, or empty to listen on all interfaces
+static int open_socket(const char *address, bool listening)
+{
+    int fd = -1;
+
+    if (const char *path = string_prefix(address, "unix:")) {
+        sockaddr_un sa = {};
+        sa.sun_family  = AF_UNIX;
+        if (strlen(path) >= sizeof(sa.sun_path))
+            DIE("Socket path too long: '%s'\n", path);
+        strcpy(sa.sun_path, path);
+
+        DIE_IF(0, (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0);
+        if (listening) {
+            unlink(path);  // left by a previous coordinator
+            DIE_IF(0, bind(fd, (const sockaddr *)&sa, sizeof(sa)) < 0);
+            DIE_IF(0, listen(fd, SOMAXCONN) < 0);
+        }
+        else
+            DIE_IF(0, connect(fd, (const sockaddr *)&sa, sizeof(sa)) < 0);
+    }
+    else {
+        // Numeric addresses only: resolving names with getaddrinfo() would need the
+        // shared libraries of the glibc we link statically with
+        const char *colon = strrchr(address, ':');
+        if (!colon)
+            DIE("Illegal address '%s'\n", address);
+        std::string host(address, colon - address);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);  // "[::1]:PORT"
+
+        char *end;
+        const long port = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end || port < 1 || port > 65535)
+            DIE("Illegal port in address '%s'\n", address);
+
+        sockaddr_storage ss  = {};
+        socklen_t        len = sizeof(sockaddr_in);
+        auto            *sa4 = (sockaddr_in *)&ss;
+        auto            *sa6 = (sockaddr_in6 *)&ss;
+        if (host.empty()) {  // all interfaces to listen, the local host to connect
+            sa4->sin_family      = AF_INET;
+            sa4->sin_addr.s_addr = htonl(listening ? INADDR_ANY : INADDR_LOOPBACK);
+        }
+        else if (inet_pton(AF_INET, host.c_str(), &sa4->sin_addr) == 1)
+            sa4->sin_family = AF_INET;
+        else if (inet_pton(AF_INET6, host.c_str(), &sa6->sin6_addr) == 1) {
+            sa6->sin6_family = AF_INET6;
+            len              = sizeof(sockaddr_in6);
+        }
+        else
+            DIE("Illegal address '%s': HOST must be a numeric IPv4 or IPv6 address\n",
+                address);
+        if (ss.ss_family == AF_INET)
+            sa4->sin_port = htons((uint16_t)port);
+        else
+            sa6->sin6_port = htons((uint16_t)port);
+
+        DIE_IF(0, (fd = socket(ss.ss_family, SOCK_STREAM, 0)) < 0);
+        if (listening) {
+            const int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            DIE_IF(0, bind(fd, (const sockaddr *)&ss, len) < 0);
+            DIE_IF(0, listen(fd, SOMAXCONN) < 0);
+        }
+        else
+            DIE_IF(0, connect(fd, (const sockaddr *)&ss, len) < 0);
+    }
+
+    socket_setup(fd);
+    return fd;
+}
+
+// Identifies the tournament, which workers must play with the same options
+static std::string hello_line(const JobQueue &jq, const std::vector<std::string> &outputs)
+{
+    std::string hello = format("hello %zu %zu", jq.job_count(), jq.results.size());
+    for (const std::string &output : outputs)
+        hello += " " + output;
+    return hello;
+}
+
+Connection::Connection(int fd)
+{
+    in.open(fd);
+}
+
+Connection::~Connection()
+{
+    in.close();
+}
+
+bool Connection::send(const std::string &msg)
+{
+    std::lock_guard lock(sendMtx);
+
+    for (size_t sent = 0; sent < msg.size();) {
+        const ssize_t n =
+            ::send(in.get_fd(), msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+        if (n > 0)
+            sent += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+void Connection::shutdown()
+{
+    ::shutdown(in.get_fd(), SHUT_RDWR);
+}
+
+RemoteClient::RemoteClient(const char *                    address,
+                           const JobQueue &                jq,
+                           const std::vector<std::string> &outputs,
+                           int                             batch_)
+    : seed(0), conn(open_socket(address, false)), batch(batch_)
+{
+    std::string_view line;
+
+    if (!conn.send(hello_line(jq, outputs) + "\n") || !conn.getline(line))
+        DIE("Connection to the coordinator lost\n");
+    if (sscanf(line.data(), "welcome %" SCNu64, &seed) != 1)
+        DIE("Coordinator: %s\n", line.data());
+
+    printf("Connected to coordinator %s\n", address);
+    reader = std::thread([this] { read_loop(); });
+}
+
+RemoteClient::~RemoteClient()
+{
+    {
+        std::lock_guard lock(mtx);
+        closing = true;
+    }
+    conn.shutdown();
+    reader.join();
+}
+
+void RemoteClient::read_loop()
+{
+    std::string_view line;
+
+    while (conn.getline(line)) {
+        std::lock_guard lock(mtx);
+
+        if (line == "stop") {
+            stopped = true;
+            jobs.clear();
+        }
+        else if (const char *tail = string_prefix(line.data(), "jobs")) {
+            if (stopped)
+                continue;  // answer the coordinator sent before the stop
+            char *end;
+            for (size_t idx; (idx = strtoull(tail, &end, 10)), end != tail; tail = end)
+                jobs.push_back(idx);
+            noMore    = jobs.empty();
+            requested = false;
+        }
+
+        cv.notify_all();
+    }
+
+    std::lock_guard lock(mtx);
+    if (!closing)
+        DIE("Connection to the coordinator lost\n");
+}
+
+void RemoteClient::request()
+{
+    if (!requested && !noMore && !stopped) {
+        requested = true;
+        if (!conn.send(format("jobs %d\n", batch)))
+            DIE("Connection to the coordinator lost\n");
+    }
+}
+
+// The next batch is asked for as the last job of the current one is started, so that
+// the other threads need not wait for it
+bool RemoteClient::pop(size_t &idx)
+{
+    std::unique_lock lock(mtx);
+
+    while (jobs.empty() && !noMore && !stopped) {
+        request();
+        cv.wait(lock);
+    }
+
+    if (jobs.empty())
+        return false;
+
+    idx = jobs.front();
+    jobs.pop_front();
+    if (jobs.empty())
+        request();
+
+    return true;
+}
+
+void RemoteClient::send_name(int ei, const std::string &name)
+{
+    if (!conn.send(format("name %d %s\n", ei, name.c_str())))
+        DIE("Connection to the coordinator lost\n");
+}
+
+void RemoteClient::send_result(size_t idx, int wld, const GameRecords &records)
+{
+    std::string msg = format("result %zu %d %zu\n", idx, wld, records.size());
+    for (const auto &[output, data] : records) {
+        msg += format("record %s %zu\n", output.c_str(), data.size());
+        msg += data;
+    }
+
+    if (!conn.send(msg))
+        DIE("Connection to the coordinator lost\n");
+}
+
+Coordinator::Coordinator(const char *                    address,
+                         JobQueue *                      jq_,
+                         uint64_t                        seed_,
+                         const std::vector<std::string> &outputs_,
+                         RecordFn                        record_)
+    : hello(hello_line(*jq_, outputs_))
+    , outputs(outputs_)
+    , seed(seed_)
+    , jq(jq_)
+    , record(record_)
+    , listenFd(open_socket(address, true))
+{
+    if (const char *path = string_prefix(address, "unix:"))
+        unixPath = path;
+
+    printf("Coordinator listening on %s\n", address);
+}
+
+Coordinator::~Coordinator()
+{
+    close(listenFd);
+    if (!unixPath.empty())
+        unlink(unixPath.c_str());
+}
+
+void Coordinator::run()
+{
+    for (;;) {
+        reap(false);
+        {
+            std::lock_guard lock(mtx);
+            if (jq->done() && lost.empty() && !open)
+                break;
+        }
+
+        // Wake up regularly, to see the end of the run and reap the clients gone
+        pollfd pfd = {listenFd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        const int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+        socket_setup(fd);
+
+        std::lock_guard lock(mtx);
+        Client &        c = *clients.emplace_back(std::make_shared<Client>(fd));
+        open++;
+        c.thread = std::thread([this, &c] { serve(c); });
+    }
+
+    reap(true);
+}
+
+// Joins the threads of the clients served, or of all clients, and forgets them
+void Coordinator::reap(bool all)
+{
+    std::vector<std::shared_ptr<Client>> gone;
+    {
+        std::lock_guard lock(mtx);
+        for (auto it = clients.begin(); it != clients.end();)
+            if (all || (*it)->done) {
+                gone.push_back(std::move(*it));
+                it = clients.erase(it);
+            }
+            else
+                ++it;
+    }
+
+    for (auto &c : gone)
+        c->thread.join();
+}
+
+// With mtx held: answers a client asking for jobs, lost ones first. When none are left,
+// the answer waits as long as jobs handed out to other clients may be lost, and be handed
+// out again.
+std::string Coordinator::answer(Client &c)
+{
+    std::string msg    = "jobs";
+    size_t      handed = 0;
+
+    for (; handed < c.waiting && !stopped; handed++) {
+        size_t idx, count;
+        Job    job;
+
+        if (!lost.empty()) {
+            idx = lost.back();
+            lost.pop_back();
+        }
+        else if (!jq->pop(1, job, idx, count))
+            break;
+
+        c.jobs.push_back(idx);
+        msg += format(" %zu", idx);
+    }
+
+    const bool over = std::none_of(clients.begin(), clients.end(), [](auto &client) {
+        return !client->jobs.empty();
+    });
+    if (!handed && !stopped && !over)
+        return {};
+
+    c.waiting = 0;
+    return msg + "\n";
+}
+
+// With mtx held
+void Coordinator::answer_waiting(Outbox &out)
+{
+    for (auto &client : clients)
+        if (client->waiting) {
+            std::string msg = answer(*client);
+            if (!msg.empty())
+                out.emplace_back(client, std::move(msg));
+        }
+}
+
+void Coordinator::send(const Outbox &out)
+{
+    for (const auto &[client, msg] : out)
+        client->conn.send(msg);  // a lost client is seen by its thread
+}
+
+void Coordinator::stop_all()
+{
+    Outbox out;
+    {
+        std::lock_guard lock(mtx);
+        stopped = true;
+        lost.clear();
+        for (auto &client : clients)
+            if (!client->done)
+                out.emplace_back(client, "stop\n");
+    }
+    send(out);
+}
+
+void Coordinator::serve(Client &c)
+{
+    std::string_view line;
+
+    if (c.conn.getline(line)) {
+        if (line != hello)
+            c.conn.send("refuse the worker options differ from the coordinator's\n");
+        else if (c.conn.send(format("welcome %" PRIu64 "\n", seed)))
+            while (c.conn.getline(line)) {
+                size_t idx, n, records;
+                int    ei, wld, namePos = 0;
+
+                if (sscanf(line.data(), "jobs %zu", &n) == 1 && n > 0) {
+                    std::unique_lock lock(mtx);
+                    c.waiting             = n;
+                    const std::string msg = answer(c);
+                    lock.unlock();
+                    if (!msg.empty())
+                        c.conn.send(msg);
+                }
+                else if (sscanf(line.data(), "name %d %n", &ei, &namePos) == 1 && namePos
+                         && ei >= 0 && ei < (int)jq->names.size())
+                    jq->set_name(ei, line.substr(namePos));
+                else if (sscanf(line.data(), "result %zu %d %zu", &idx, &wld, &records) == 3
+                         && 0 <= wld && wld < NB_RESULT) {
+                    GameRecords gameRecords;
+                    std::string output, data;
+                    size_t      len;
+
+                    for (size_t i = 0; i < records; i++) {
+                        char name[16];
+                        if (!c.conn.getline(line)
+                            || sscanf(line.data(), "record %15s %zu", name, &len) != 2
+                            || std::find(outputs.begin(), outputs.end(), output = name)
+                                   == outputs.end()
+                            || !c.conn.read(data, len))
+                            break;
+                        gameRecords.emplace_back(output, data);
+                    }
+
+                    if (gameRecords.size() != records)
+                        break;
+
+                    // Only the jobs handed out to the client are taken
+                    std::unique_lock lock(mtx);
+                    auto             it = std::find(c.jobs.begin(), c.jobs.end(), idx);
+                    if (it == c.jobs.end())
+                        break;
+                    c.jobs.erase(it);
+                    lock.unlock();
+
+                    if (record(idx, wld, gameRecords))
+                        stop_all();
+
+                    Outbox out;
+                    lock.lock();
+                    answer_waiting(out);
+                    lock.unlock();
+                    send(out);
+                }
+                else
+                    break;
+            }
+    }
+
+    // Jobs without a result are handed out again
+    c.conn.shutdown();
+    Outbox out;
+    {
+        std::lock_guard lock(mtx);
+        if (!stopped)
+            lost.insert(lost.end(), c.jobs.begin(), c.jobs.end());
+        c.jobs.clear();
+        c.waiting = 0;
+        c.done    = true;
+        open--;
+        answer_waiting(out);
+    }
+    send(out);
+}
+
+#else
+
+Connection::Connection(int) {}
+
+Connection::~Connection() {}
+
+RemoteClient::RemoteClient(const char *,
+                           const JobQueue &,
+                           const std::vector<std::string> &,
+                           int)
+    : seed(0), conn(-1), batch(0)
+{
+    DIE("Coordinator/worker mode is not available on Windows\n");
+}
+
+RemoteClient::~RemoteClient() {}
+
+bool RemoteClient::pop(size_t &) { return false; }
+
+void RemoteClient::send_name(int, const std::string &) {}
+
+void RemoteClient::send_result(size_t, int, const GameRecords &) {}
+
+Coordinator::Coordinator(const char *,
+                         JobQueue *jq_,
+                         uint64_t,
+                         const std::vector<std::string> &,
+                         RecordFn record_)
+    : seed(0), jq(jq_), record(record_), listenFd(-1)
+{
+    DIE("Coordinator/worker mode is not available on Windows\n");
+}
+
+Coordinator::~Coordinator() {}
+
+void Coordinator::run() {}
+
+#endif
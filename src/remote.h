@@ -0,0 +1,148 @@
+/*
+ *  c-gomoku-cli, a command line interface for Gomocup engines. Copyright 2021 Chao Ma.
+ *  c-gomoku-cli is derived from c-chess-cli, originally authored by lucasart 2020.
+ *
+ *  c-gomoku-cli is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ *  c-gomoku-cli is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this
+ * program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "jobs.h"
+#include "util.h"
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Coordinator/worker mode (POSIX only): a coordinator process owns the job queue, the
+// results and the output files, and worker processes, on any machine, connect to it over
+// a TCP or Unix socket ("HOST:PORT" or "unix:PATH"), pull batches of jobs, play them, and
+// send back the result and output records of each game. Messages are text lines, and
+// records follow their line as raw bytes:
+//
+//   worker -> coordinator                   coordinator -> worker
+//   hello JOBS PAIRS OUTPUT...              welcome SEED (or refuse REASON)
+//   jobs N          (asks for N jobs)       jobs IDX...  (empty when none are left)
+//   name EI NAME                            stop         (drop the jobs not started)
+//   result IDX WLD RECORDS
+//   record OUTPUT LEN, then LEN bytes
+//
+// Jobs of a worker that disconnects without their result are handed out again.
+
+// Records of a game, by output: "pgn", "sgf", "msg", "stats" or "samples"
+using GameRecords = std::vector<std::pair<std::string, std::string>>;
+
+// Socket sending whole messages from any thread, and read by a single thread
+class Connection
+{
+public:
+    explicit Connection(int fd);
+    ~Connection();
+
+    bool send(const std::string &msg);  // false if the connection is lost
+    bool getline(std::string_view &line) { return in.getline(line); }
+    bool read(std::string &out, size_t n) { return in.read(out, n); }
+    void shutdown();  // wakes up the reader
+
+private:
+    std::mutex sendMtx;
+    LineReader in;
+};
+
+// Worker side: jobs come from the coordinator
+class RemoteClient
+{
+public:
+    RemoteClient(const char *                    address,
+                 const JobQueue &                jq,
+                 const std::vector<std::string> &outputs,
+                 int                             batch);
+    ~RemoteClient();
+
+    bool pop(size_t &idx);  // false when there are no jobs left, or the run is stopped
+    void send_name(int ei, const std::string &name);
+    void send_result(size_t idx, int wld, const GameRecords &records);
+
+    uint64_t seed;  // of the openings shuffle
+
+private:
+    void read_loop();
+    void request();  // with mtx held
+
+    Connection              conn;
+    const int               batch;
+    std::thread             reader;
+    std::mutex              mtx;
+    std::condition_variable cv;
+    std::deque<size_t>      jobs;  // received, not started
+    bool requested = false, noMore = false, stopped = false, closing = false;
+};
+
+// Coordinator side: serves the jobs of the queue to workers
+class Coordinator
+{
+public:
+    // record() writes a game played by a worker, and returns true to stop the run
+    using RecordFn = bool (*)(size_t idx, int wld, const GameRecords &records);
+
+    Coordinator(const char *                    address,
+                JobQueue *                      jq,
+                uint64_t                        seed,
+                const std::vector<std::string> &outputs,
+                RecordFn                        record);
+    ~Coordinator();
+
+    // Serves workers until all games are played, or the run is stopped, and the workers
+    // are gone
+    void run();
+
+private:
+    struct Client
+    {
+        Connection          conn;
+        std::thread         thread;       // serving the client
+        std::vector<size_t> jobs;         // handed out, result not received yet
+        size_t              waiting = 0;  // jobs asked for, not answered yet
+        bool                done    = false;  // served, the thread can be joined
+        explicit Client(int fd) : conn(fd) {}
+    };
+
+    // Messages built with mtx held, sent once it is released: a client that does not
+    // read must not block the others
+    using Outbox = std::vector<std::pair<std::shared_ptr<Client>, std::string>>;
+
+    void        serve(Client &c);
+    std::string answer(Client &c);  // empty when the client must wait
+    void        answer_waiting(Outbox &out);
+    void        stop_all();
+    void        reap(bool all);
+    static void send(const Outbox &out);
+
+    const std::string              hello;  // expected from workers
+    const std::vector<std::string> outputs;
+    const uint64_t                 seed;
+    JobQueue *const                jq;
+    const RecordFn                 record;
+    std::string                    unixPath;  // removed at the end
+    int                            listenFd;
+
+    std::mutex                         mtx;
+    std::list<std::shared_ptr<Client>> clients;
+    std::vector<size_t>                lost;  // jobs of clients gone, to hand out again
+    int                                open    = 0;
+    bool                               stopped = false;
+};
@@ -16,6 +16,8 @@
 
 #include "seqwriter.h"
 
+#include "util.h"
+
 #include <algorithm>
 #include <cassert>
 #include <cstring>
@@ -26,7 +28,8 @@ template <typename T> auto insert_sorted(std::vector<T> &vec, T &&item)
     return vec.insert(pos, std::move(item));
 }
 
-SeqWriter::SeqWriter(const char *fileName, const char *mode) : idxNext(0)
+SeqWriter::SeqWriter(const char *fileName, const char *mode, size_t idxFirst)
+    : idxNext(idxFirst)
 {
     out = fopen(fileName, mode);
 }
@@ -58,6 +61,26 @@ void SeqWriter::push(size_t idx, std::string_view str)
         write_to_i(i);
 }
 
+SeqWriterState SeqWriter::state()
+{
+    std::lock_guard lock(mtx);
+
+    // Records are flushed as they are written, so the end of the file is theirs
+    DIE_IF(0, fseek(out, 0, SEEK_END) < 0);
+    return {ftell(out), idxNext, buf};
+}
+
+void SeqWriter::restore(SeqWriterState &&state)
+{
+    std::lock_guard lock(mtx);
+    assert(buf.empty());
+
+    file_truncate(out, state.size);
+
+    idxNext = state.idxNext;
+    buf     = std::move(state.buf);
+}
+
 void SeqWriter::write_to_i(size_t i)
 {
     // Write buf[0..i-1] to file
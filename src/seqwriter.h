@@ -29,14 +29,27 @@ struct SeqStr
     bool operator<(const SeqStr &other) const { return idx < other.idx; }
 };
 
+// Checkpoint of a writer: size of the file after the records written, index of the next
+// record to write, and records held back until it comes
+struct SeqWriterState
+{
+    long                size;
+    size_t              idxNext;
+    std::vector<SeqStr> buf;
+};
+
 class SeqWriter
 {
 public:
-    SeqWriter(const char *fileName, const char *mode);
+    SeqWriter(const char *fileName, const char *mode, size_t idxFirst = 0);
     ~SeqWriter();
 
     void push(size_t idx, std::string_view str);
 
+    SeqWriterState state();
+    // drops what was written after the checkpoint, before any push()
+    void restore(SeqWriterState &&state);
+
 private:
     std::mutex          mtx;
     std::vector<SeqStr> buf;
@@ -19,9 +19,14 @@
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #ifdef __MINGW32__
     #include <Windows.h>
+    #include <io.h>
+#else
+    #include <sched.h>
+    #include <unistd.h>
 #endif
 #include "util.h"
 
@@ -54,6 +59,57 @@ void system_sleep(int64_t msec)
     nanosleep(&t, NULL);
 }
 
+#ifdef __linux__
+// Reads an integer from a sysfs file, -1 if it does not exist
+static int read_sysfs_int(const std::string &fileName)
+{
+    int   value = -1;
+    FILE *f     = fopen(fileName.c_str(), "r" FOPEN_TEXT);
+    if (f) {
+        if (fscanf(f, "%d", &value) != 1)
+            value = -1;
+        fclose(f);
+    }
+    return value;
+}
+#endif
+
+std::vector<int> system_cpus()
+{
+    std::vector<int> cpus;
+
+#ifdef __linux__
+    cpu_set_t allowed;
+    DIE_IF(0, sched_getaffinity(0, sizeof(allowed), &allowed) < 0);
+
+    // Physical cores are told apart by their (package, core) ids
+    std::vector<std::pair<int, int>> cores;
+    std::vector<int>                 siblings;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+
+        const std::string dir = format("/sys/devices/system/cpu/cpu%d/topology/", cpu);
+        const auto        core =
+            std::make_pair(read_sysfs_int(dir + "physical_package_id"),
+                           read_sysfs_int(dir + "core_id"));
+
+        if (core.second < 0
+            || std::find(cores.begin(), cores.end(), core) == cores.end()) {
+            cores.push_back(core);
+            cpus.push_back(cpu);
+        }
+        else
+            siblings.push_back(cpu);
+    }
+
+    cpus.insert(cpus.end(), siblings.begin(), siblings.end());
+#endif
+
+    return cpus;
+}
+
 FileLock::FileLock(FILE *file) : f(file)
 {
 #ifdef __MINGW32__
@@ -138,6 +194,112 @@ size_t string_getline(std::string &out, FILE *in)
     return out.size() + (c == '\n');
 }
 
+void file_truncate(FILE *f, long size)
+{
+    DIE_IF(0, fflush(f) < 0);
+    DIE_IF(0, fseek(f, 0, SEEK_END) < 0);
+    if (ftell(f) < size)
+        DIE("file is shorter than expected (%ld bytes)\n", size);
+    DIE_IF(0, ftruncate(fileno(f), size) < 0);
+    DIE_IF(0, fseek(f, 0, SEEK_END) < 0);
+}
+
+void LineReader::open(int fileDesc)
+{
+    assert(fileDesc >= 0);
+    fd   = fileDesc;
+    head = tail = 0;
+    if (buf.empty())
+        buf.resize(4096);
+}
+
+int LineReader::close()
+{
+    const int fileDesc = fd;
+    fd                 = -1;
+#ifdef __MINGW32__
+    return _close(fileDesc);
+#else
+    return ::close(fileDesc);
+#endif
+}
+
+bool LineReader::getline(std::string_view &line)
+{
+    // Returns the line in buf[head, end), end being the '\n' or the end of data
+    auto takeLine = [&](size_t end) {
+        const size_t next = end + 1;
+        if (end > head && buf[end - 1] == '\r')
+            end--;
+        buf[end] = '\0';
+        line     = std::string_view(buf.data() + head, end - head);
+        head     = std::min(next, tail);
+        return true;
+    };
+
+    blocked = false;
+
+    while (true) {
+        if (const void *nl = memchr(buf.data() + head, '\n', tail - head))
+            return takeLine((const char *)nl - buf.data());
+
+        if (fd < 0)
+            return false;
+
+        // Make room for more data, keeping one byte to null terminate a last line
+        if (tail + 1 >= buf.size()) {
+            if (head > 0) {
+                memmove(buf.data(), buf.data() + head, tail - head);
+                tail -= head;
+                head = 0;
+            }
+            else
+                buf.resize(2 * buf.size());
+        }
+
+#ifdef __MINGW32__
+        const int n = _read(fd, buf.data() + tail, buf.size() - tail - 1);
+#else
+        const ssize_t n = ::read(fd, buf.data() + tail, buf.size() - tail - 1);
+#endif
+
+        if (n > 0)
+            tail += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return !(blocked = true);
+        else
+            return tail > head ? takeLine(tail) : false;
+    }
+}
+
+bool LineReader::read(std::string &out, size_t n)
+{
+    // Bytes already buffered first
+    size_t got = std::min(n, tail - head);
+    out.assign(buf.data() + head, got);
+    head += got;
+    out.resize(n);
+
+    while (got < n) {
+#ifdef __MINGW32__
+        const int r = _read(fd, out.data() + got, n - got);
+#else
+        const ssize_t r = ::read(fd, out.data() + got, n - got);
+#endif
+
+        if (r > 0)
+            got += r;
+        else if (r < 0 && errno == EINTR)
+            continue;
+        else
+            return false;
+    }
+
+    return true;
+}
+
 // Read next character using escape character. Result in *out. Retuns tail pointer, and
 // sets escaped=true if escape character parsed.
 static const char *string_getc_esc(const char *s, char *out, bool *escaped, char esc)
@@ -19,6 +19,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <string_view>
+#include <vector>
 
 uint64_t prng(uint64_t &state);
 double   prngf(uint64_t &state);
@@ -26,6 +28,10 @@ double   prngf(uint64_t &state);
 int64_t system_msec(void);
 void    system_sleep(int64_t msec);
 
+// CPUs the process may run on: the first CPU of each physical core, followed by the
+// other SMT siblings. Linux only, empty elsewhere.
+std::vector<int> system_cpus(void);
+
 struct FileLock
 {
     FILE *f;
@@ -102,6 +108,38 @@ template <typename... Args> std::string format(const char *fmt, Args &&...args)
 // still counted.
 size_t string_getline(std::string &out, FILE *in);
 
+// cuts file 'f' back to 'size' bytes, which it must have at least, and seeks to its end
+void file_truncate(FILE *f, long size);
+
+// Buffered line reader on a raw file descriptor, for pipes having a single reader
+// thread, so no locking is done. Lines are split with memchr() in the buffer and returned
+// as views into it, null terminated in place, with the '\n' (and a '\r' before it)
+// discarded. A view remains valid until the next getline().
+class LineReader
+{
+public:
+    void open(int fd);
+    int  close();  // returns the result of closing the file descriptor
+    bool is_open() const { return fd >= 0; }
+    int  get_fd() const { return fd; }
+
+    // returns false on EOF or read error. A last line without '\n' is still returned.
+    // Also returns false when a non blocking fd has no complete line yet, which is told
+    // apart by would_block().
+    bool getline(std::string_view &line);
+    bool would_block() const { return blocked; }
+
+    // reads exactly n bytes, following the lines read so far (blocking fd only). Returns
+    // false on EOF or read error.
+    bool read(std::string &out, size_t n);
+
+private:
+    std::vector<char> buf;
+    size_t            head = 0, tail = 0;  // unread bytes are buf[head, tail)
+    int               fd      = -1;
+    bool              blocked = false;
+};
+
 // reads a token into valid string 'token', from s, using delim characters as a
 // generalisation for white spaces. returns tail pointer on success, otherwise NULL (no
 // more tokens to read).
@@ -2,10 +2,17 @@
 
 #include "util.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cinttypes>
 #include <cstdlib>
 
-Worker::Worker(int i, const char *logName) : id(i + 1), seed(i), log(nullptr)
+Worker::Worker(int i, const char *logName)
+    : id(i + 1)
+    , seed(i)
+    , log(nullptr)
+    , watchdog(nullptr)
 {
     if (*logName) {
         log = fopen(logName, "w" FOPEN_TEXT);
@@ -21,6 +28,13 @@ Worker::~Worker()
     }
 }
 
+void Worker::add_engine_usage(int ei, const EngineUsage &usage)
+{
+    if (engineUsage.size() <= (size_t)ei)
+        engineUsage.resize(ei + 1);
+    engineUsage[ei].add(usage);
+}
+
 void Worker::deadline_set(const char *          engineName,
                           int64_t               timeLimit,
                           const char *          description,
@@ -39,6 +53,9 @@ void Worker::deadline_set(const char *          engineName,
         deadline.callback    = callback;
     }
 
+    if (watchdog)
+        watchdog->arm(this, timeLimit);
+
     if (log)
         DIE_IF(id,
                fprintf(log,
@@ -51,21 +68,26 @@ void Worker::deadline_set(const char *          engineName,
 
 void Worker::deadline_clear()
 {
-    std::lock_guard lock(deadline.mtx);
+    {
+        std::lock_guard lock(deadline.mtx);
 
-    deadline.set = false;
+        deadline.set = false;
 
-    if (log)
-        DIE_IF(id,
-               fprintf(log,
-                       "deadline: %s responded [%s] before %" PRId64 "\n",
-                       deadline.engineName.c_str(),
-                       deadline.description.c_str(),
-                       deadline.timeLimit)
-                   < 0);
+        if (log)
+            DIE_IF(id,
+                   fprintf(log,
+                           "deadline: %s responded [%s] before %" PRId64 "\n",
+                           deadline.engineName.c_str(),
+                           deadline.description.c_str(),
+                           deadline.timeLimit)
+                       < 0);
+    }
+
+    if (watchdog)
+        watchdog->cancel(this);
 }
 
-void Worker::deadline_callback_once()
+bool Worker::deadline_callback_once()
 {
     std::lock_guard lock(deadline.mtx);
 
@@ -73,7 +95,10 @@ void Worker::deadline_callback_once()
         deadline.called = true;
         if (deadline.callback)
             deadline.callback();
+        return true;
     }
+
+    return false;
 }
 
 int64_t Worker::deadline_overdue()
@@ -92,4 +117,112 @@ void Worker::wait_callback_done()
 {
     deadline.mtx.lock();
     deadline.mtx.unlock();
-}
\ No newline at end of file
+}
+
+void Watchdog::arm(Worker *w, int64_t timeLimit)
+{
+    {
+        std::lock_guard lock(mtx);
+
+        // replaces the timer of the worker, if any
+        w->timerGen++;
+        if (!w->timerArmed) {
+            w->timerArmed = true;
+            armed++;
+        }
+
+        timers.push_back({timeLimit + 1, w, w->timerGen});
+        std::push_heap(timers.begin(), timers.end(), std::greater<Timer>());
+        compact();
+    }
+
+    cv.notify_one();
+}
+
+void Watchdog::cancel(Worker *w)
+{
+    std::lock_guard lock(mtx);
+
+    if (w->timerArmed) {
+        w->timerGen++;
+        w->timerArmed = false;
+        armed--;
+        compact();
+    }
+}
+
+void Watchdog::compact()
+{
+    // A few stale timers are cheaper to leave until they expire
+    if (timers.size() <= 2 * armed + 16)
+        return;
+
+    timers.erase(std::remove_if(timers.begin(),
+                                timers.end(),
+                                [](const Timer &timer) { return timer.stale(); }),
+                 timers.end());
+    std::make_heap(timers.begin(), timers.end(), std::greater<Timer>());
+}
+
+int64_t Watchdog::fire(std::vector<Worker *> *fired)
+{
+    while (true) {
+        Timer timer;
+        {
+            std::lock_guard lock(mtx);
+
+            while (!timers.empty() && timers.front().stale()) {
+                std::pop_heap(timers.begin(), timers.end(), std::greater<Timer>());
+                timers.pop_back();
+            }
+
+            if (timers.empty())
+                return INT64_MAX;
+            else if (timers.front().expiry > system_msec())
+                return timers.front().expiry;
+
+            timer = timers.front();
+            std::pop_heap(timers.begin(), timers.end(), std::greater<Timer>());
+            timers.pop_back();
+            timer.w->timerArmed = false;
+            armed--;
+        }
+
+        // The callback runs without holding the timers, as it may set a new deadline
+        if (timer.w->deadline_overdue() > 0 && timer.w->deadline_callback_once()
+            && fired)
+            fired->push_back(timer.w);
+    }
+}
+
+void Watchdog::run()
+{
+    std::unique_lock lock(mtx);
+
+    while (!stopped) {
+        lock.unlock();
+        int64_t next = fire();
+        lock.lock();
+
+        // A timer may have been armed while firing. Later ones, and stop(), notify us.
+        if (!timers.empty())
+            next = std::min(next, timers.front().expiry);
+
+        if (stopped)
+            break;
+        else if (next == INT64_MAX)
+            cv.wait(lock);
+        else
+            cv.wait_for(lock, std::chrono::milliseconds(next - system_msec()));
+    }
+}
+
+void Watchdog::stop()
+{
+    {
+        std::lock_guard lock(mtx);
+        stopped = true;
+    }
+
+    cv.notify_one();
+}
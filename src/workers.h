@@ -15,6 +15,9 @@
  */
 
 #pragma once
+#include "engine.h"
+
+#include <condition_variable>
 #include <cstdio>
 #include <functional>
 #include <mutex>
@@ -24,6 +27,8 @@
 // Game results
 enum { RESULT_LOSS, RESULT_DRAW, RESULT_WIN, NB_RESULT };
 
+class Watchdog;
+
 // Per thread data
 class Worker
 {
@@ -43,16 +48,73 @@ public:
     Deadline_t deadline;
     uint64_t   seed;  // seed for prng()
     FILE *     log;
+    Watchdog * watchdog;  // enforces the deadlines
+
+    // Timer slot of the worker in its watchdog, guarded by the watchdog: only the timer
+    // of the current generation is live
+    uint64_t timerGen   = 0;
+    bool     timerArmed = false;
+
+    std::vector<int> cpus;  // CPUs the engines are pinned to, any CPU if empty
+
+    // engine starts, and their total time from spawn to the ABOUT answer
+    uint64_t spawnCount = 0;
+    int64_t  spawnUsec  = 0;
+
+    uint64_t restartsAvoided = 0;  // engines reused from the EnginePool
+
+    // by engine index: moves played in the games of the worker, and engines it terminated
+    std::vector<EngineUsage> engineUsage;
 
     Worker(int id, const char *logName);
     ~Worker();
 
+    void add_engine_usage(int ei, const EngineUsage &usage);
+
     void    deadline_set(const char *          engineName,
                          int64_t               timeLimit,
                          const char *          description,
                          std::function<void()> callback = nullptr);
     void    deadline_clear();
-    void    deadline_callback_once();
+    bool    deadline_callback_once();  // returns true if the deadline was called back
     int64_t deadline_overdue();
     void    wait_callback_done();
 };
+
+// Deadline timers of a set of workers, in a min heap. Each worker has a single timer
+// slot: deadline_set() arms it, expiring at the first msec the deadline is overdue, and
+// deadline_clear() cancels it. Cancelled and replaced timers are left in the heap, marked
+// stale by the generation of their worker, and dropped at expiry or when the heap is
+// compacted, once stale timers outnumber the live ones.
+class Watchdog
+{
+public:
+    void arm(Worker *w, int64_t timeLimit);
+    void cancel(Worker *w);
+
+    // Calls back the overdue workers, adding them to fired if given, and returns the
+    // time of the next timer (INT64_MAX if none)
+    int64_t fire(std::vector<Worker *> *fired = nullptr);
+
+    // Sleeps until each timer expires and fires it, until stop() is called
+    void run();
+    void stop();
+
+private:
+    struct Timer
+    {
+        int64_t  expiry;
+        Worker * w;
+        uint64_t gen;
+        bool     operator>(const Timer &other) const { return expiry > other.expiry; }
+        bool     stale() const { return gen != w->timerGen; }
+    };
+
+    void compact();  // with mtx held
+
+    std::mutex              mtx;
+    std::condition_variable cv;
+    std::vector<Timer>      timers;  // heap, the first timer to expire on top
+    size_t                  armed   = 0;  // live timers
+    bool                    stopped = false;
+};